@@ -3,11 +3,13 @@
 CMD=$1
 ARG=$2
 if [[ "$CMD" == "" ]]; then
-    echo "usage: $0 [build|run|count]"
+    echo "usage: $0 [build|prepare|run|report|count|single <function>|server]"
     exit 1
 fi
 
-if [[ ! -f config ]]; then
+# RSC_CONFIG selects another config, e.g. for synthetic corpora
+CONFIG=${RSC_CONFIG:-config}
+if [[ ! -f $CONFIG ]]; then
     echo "Please create a config according to config.template"
     exit 1
 fi
@@ -16,7 +18,7 @@ export CURRENT_DIR=`pwd`
 TEST_DIR=$CURRENT_DIR/tests
 SCRIPT_DIR=$CURRENT_DIR/scripts
 SRC_DIR=$CURRENT_DIR/src
-source config
+source $CONFIG
 export ABS_WORK_DIR=`readlink -f $WORK_DIR`
 
 if [[ ! -f $CURRENT_DIR/rsc.so ]]; then
@@ -59,6 +61,9 @@ case $CMD in
 	$SCRIPT_DIR/bcdep/markeff.py dep.db
 	$SCRIPT_DIR/bcdep/mkgen.py -t $CURRENT_DIR dep.db
 	make -f Makefile.scc all -j8
+	$SCRIPT_DIR/bcdep/fnpart.py -t $CURRENT_DIR dep.db
+	$SCRIPT_DIR/bcdep/mkgen.py -t $CURRENT_DIR dep.db
+	make -f Makefile.fn all
 	$SCRIPT_DIR/blackwhitelist-gen
 	popd > /dev/null
 	;;
@@ -80,9 +85,22 @@ case $CMD in
 	done
 	popd > /dev/null
 	;;
+    single)
+	# Analyze one function on the closure of its callees only
+	pushd $ABS_WORK_DIR > /dev/null
+	$CURRENT_DIR/rsc-closure -index symbol-index -o $ARG.bc $ARG
+	opt -analyze -quiet -load $CURRENT_DIR/rsc.so -rsc -single-fn $ARG -o-progress $ARG.bc
+	popd > /dev/null
+	;;
+    server)
+	# Keep everything in memory and answer queries on rsc.sock
+	pushd $ABS_WORK_DIR > /dev/null
+	$CURRENT_DIR/rsc-server -bclist abs_bclist -inline-list inline-list -socket rsc.sock
+	popd > /dev/null
+	;;
     count)
 	pushd $ABS_WORK_DIR > /dev/null
-	opt -analyze -quiet -load $CURRENT_DIR/rsc.so -o-progress -count $TARGET 2> count.txt | tee count-time.txt
+	opt -analyze -quiet -load $CURRENT_DIR/rsc.so -o-progress -mem-log memory.log -count $TARGET 2> count.txt | tee count.json
 	popd > /dev/null
 	;;
     *)
@@ -16,6 +16,7 @@ SEEDS = {'kref_init', 'kref_get', 'kref_get_unless_zero',
 
 parser = argparse.ArgumentParser()
 parser.add_argument('-d', '--database', type=str, default='dep.db')
+parser.add_argument('-s', '--symbol-index', type=str, default='symbol-index')
 parser.add_argument('bclist', type=str)
 parser_args = parser.parse_args()
 
@@ -40,6 +41,8 @@ bc_id = {}
 defined_in = {}
 used_in = collections.defaultdict(lambda: [])
 weak_in = collections.defaultdict(lambda: [])
+# symbol -> defining bc, for loading single functions lazily
+symbol_in = {}
 
 f = open(bclist, 'r')
 next_id = 1
@@ -57,6 +60,8 @@ for line in f.readlines():
     p.stdout.close()
     for l in out:
         state, symbol = l.split(' ')
+        if state == 'T' or (state == 'W' and not symbol_in.has_key(symbol)):
+            symbol_in[symbol] = bc
         if symbol in SEEDS:
             effective = 1
         elif state == 'T':
@@ -94,3 +99,8 @@ for scc in sccs:
     sccid = sccid + 1
 
 conn.commit()
+
+f = open(parser_args.symbol_index, 'w')
+for k,v in sorted(symbol_in.items()):
+    print >> f, k, v
+f.close()
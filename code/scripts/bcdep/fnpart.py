@@ -0,0 +1,157 @@
+#!/usr/bin/env python
+
+# Split large file-level SCCs into function-level analysis units.
+#
+# Kernel subsystems reference each other, so a few file-level SCCs become huge
+# and their linked scc%d.bc modules serialize the whole run. For such an SCC
+# the function-level call graph is dumped with the -fcg pass, condensed into
+# function SCCs, and the function SCCs are packed into units of bounded cost.
+# Units follow the height of the function SCCs in the condensed graph, so
+# a unit only calls into units of lower heights, or of its own height when
+# that level is split: function SCCs of the same height never call each
+# other. Consecutive cheap levels are packed into one unit until it reaches
+# the unit cost, so a deep but cheap SCC does not become a chain of tiny
+# jobs. A level costing more than a unit on its own is split into units
+# balanced by cost, which are independent and run in parallel once the
+# levels below are done. Calls between units are recorded in unit_dep and
+# resolved through summaries.
+
+import sys, os
+import argparse
+import sqlite3
+import collections
+from subprocess import Popen, PIPE
+
+from scc import SCC
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-t', '--top-dir', type=str, default='')
+parser.add_argument('-c', '--unit-cost', type=int, default=50000,
+                    help='estimated cost (IR instructions) of a single unit')
+parser.add_argument('database', type=str)
+parser_args = parser.parse_args()
+
+db = parser_args.database
+topdir = parser_args.top_dir
+unit_cost = parser_args.unit_cost
+
+conn = sqlite3.connect(db)
+tables = {
+    'unit':
+    [ 'id INTEGER PRIMARY KEY AUTOINCREMENT',
+      'scc INTEGER NOT NULL',
+      'cost INTEGER'],
+    'unit_fn':
+    [ 'unit INTEGER NOT NULL',
+      'function TEXT NOT NULL'],
+    'unit_dep':
+    [ 'definer INTEGER NOT NULL',
+      'user INTEGER NOT NULL'],
+}
+for k,v in tables.items():
+    conn.execute('CREATE TABLE IF NOT EXISTS %s(%s);' % (k, ','.join(v)))
+for k in tables.keys():
+    conn.execute('DELETE FROM %s' % k)
+
+def read_fcg(bc):
+    cmd = 'opt -analyze -quiet -load %s/rsc.so -fcg %s' % (topdir, bc)
+    p = Popen(cmd, shell=True, stdin=None, stdout=PIPE, stderr=None, close_fds=True)
+    out = [line.strip() for line in p.stdout]
+    p.communicate()
+    if p.returncode != 0:
+        print bc, ': dumping call graph failed'
+        return None, None
+    cost = {}
+    succs = collections.defaultdict(lambda: set())
+    for l in out:
+        fields = l.split(' ')
+        if fields[0] == 'F':
+            cost[fields[1]] = int(fields[2])
+        elif fields[0] == 'E':
+            succs[fields[1]].add(fields[2])
+    return cost, succs
+
+def partition(cost, succs):
+    sccs = SCC(str, lambda f: succs[f]).getsccs(sorted(cost.keys()))
+    scc_of = {}
+    for i, scc in enumerate(sccs):
+        for f in scc:
+            scc_of[f] = i
+
+    # sccs are callers first, so walk backwards to see callees first
+    height = [0] * len(sccs)
+    for i in reversed(range(len(sccs))):
+        for f in sccs[i]:
+            for g in succs[f]:
+                j = scc_of[g]
+                if j != i:
+                    height[i] = max(height[i], height[j] + 1)
+
+    levels = collections.defaultdict(lambda: [])
+    for i in range(len(sccs)):
+        levels[height[i]].append(i)
+
+    # levels are packed bottom-up into the open unit while they fit; a level
+    # that fits in no unit is split, the largest SCCs first, each into the
+    # cheapest of just enough units
+    units = []
+    open_fns, open_cost = [], 0
+    for h in sorted(levels.keys()):
+        scc_cost = dict((i, sum(cost[f] for f in sccs[i])) for i in levels[h])
+        level_cost = sum(scc_cost.values())
+        if open_cost + level_cost <= unit_cost:
+            for i in levels[h]:
+                open_fns.extend(sccs[i])
+            open_cost += level_cost
+            continue
+        if open_fns:
+            units.append((open_fns, open_cost))
+        open_fns, open_cost = [], 0
+        if level_cost <= unit_cost:
+            for i in levels[h]:
+                open_fns.extend(sccs[i])
+            open_cost = level_cost
+            continue
+        n = (level_cost + unit_cost - 1) // unit_cost
+        fns, costs = [[] for _ in range(n)], [0] * n
+        for i in sorted(levels[h], key=lambda i: (-scc_cost[i], i)):
+            k = costs.index(min(costs))
+            fns[k].extend(sccs[i])
+            costs[k] += scc_cost[i]
+        units.extend((fns[k], costs[k]) for k in range(n) if fns[k])
+    if open_fns:
+        units.append((open_fns, open_cost))
+    return units
+
+cur = conn.cursor()
+cur.execute('SELECT scc, bc FROM scc_bc')
+for row in cur.fetchall():
+    scc, bc = row[0], row[1]
+    if not os.path.exists(bc):
+        continue
+    cost, succs = read_fcg(bc)
+    if cost is None or sum(cost.values()) < 2 * unit_cost:
+        continue
+
+    units = partition(cost, succs)
+    if len(units) < 2:
+        continue
+
+    unit_of = {}
+    for fns, c in units:
+        cur.execute('INSERT INTO unit (scc, cost) VALUES (%d, %d)' % (scc, c))
+        uid = cur.lastrowid
+        for f in fns:
+            unit_of[f] = uid
+            conn.execute('INSERT INTO unit_fn VALUES (%d, "%s")' % (uid, f))
+
+    deps = set()
+    for f, callees in succs.items():
+        for g in callees:
+            if unit_of[f] != unit_of[g]:
+                deps.add((unit_of[g], unit_of[f]))
+    for dep in deps:
+        conn.execute('INSERT INTO unit_dep VALUES (%d, %d)' % dep)
+    print 'scc%d: %d units' % (scc, len(units))
+
+conn.commit()
@@ -61,6 +61,11 @@ parser = argparse.ArgumentParser()
 parser.add_argument('-o', '--output', type=str, default='Makefile')
 parser.add_argument('-d', '--output-dir', type=str, default='linux')
 parser.add_argument('-t', '--top-dir', type=str, default='')
+parser.add_argument('--dep-cost', type=int, default=16384,
+                    help='estimated cost (bytes of IR) of merging one summary cache')
+parser.add_argument('--out-of-core', action='store_true',
+                    help='compute the sensitive set file by file with rsc-sensiset '
+                         'instead of over a linked linux.bc')
 parser.add_argument('database', type=str)
 parser_args = parser.parse_args()
 
@@ -68,6 +73,8 @@ output = parser_args.output
 outdir = parser_args.output_dir
 topdir = parser_args.top_dir
 db = parser_args.database
+dep_cost = parser_args.dep_cost
+out_of_core = parser_args.out_of_core
 
 conn = sqlite3.connect(db)
 
@@ -92,6 +99,24 @@ for row in cur.fetchall():
     scc_dep_on[bcid_to_scc[user]].add(bcid_to_scc[definer])
     scc_dep_by[bcid_to_scc[definer]].add(bcid_to_scc[user])
 
+# function-level units of large SCCs, see fnpart.py
+units_in_scc = collections.defaultdict(lambda: [])
+unit_cost = {}
+unit_fns = collections.defaultdict(lambda: [])
+unit_dep_on = collections.defaultdict(lambda: set())
+cur.execute("SELECT name FROM sqlite_master WHERE type='table' AND name='unit'")
+if cur.fetchall():
+    cur.execute('SELECT id, scc, cost FROM unit')
+    for row in cur.fetchall():
+        units_in_scc[row[1]].append(row[0])
+        unit_cost[row[0]] = row[2] or 0
+    cur.execute('SELECT * FROM unit_fn')
+    for row in cur.fetchall():
+        unit_fns[row[0]].append(row[1])
+    cur.execute('SELECT * FROM unit_dep')
+    for row in cur.fetchall():
+        unit_dep_on[row[1]].add(row[0])
+
 
 common_prefix = commonprefix(bcid_to_bc.values())
 scc_to_bc = {}
@@ -105,6 +130,7 @@ listf = open('scc-list', 'w')
 print >> f, 'PREFIX ?=', common_prefix
 print >> f, 'V ?= @'
 print >> f, 'TOPDIR ?=', topdir
+print >> f, 'TIME ?= /usr/bin/time -a -f %e -o'
 print >> sccf, 'PREFIX ?=', common_prefix
 print >> sccf, 'V ?= @'
 print >> sccf, 'TOPDIR ?=', topdir
@@ -135,17 +161,82 @@ for scc,bcs in bcs_in_scc.items():
     scc_to_bc[scc] = bc
     scc_to_result[scc] = target
 
+unit_to_result = {}
+for scc,units in units_in_scc.items():
+    for unit in units:
+        unit_to_result[unit] = scc_to_result[scc].replace('.result', '.u%d.result' % unit)
+
+# Jobs are ordered longest first, so that make -j starts the expensive ones
+# early instead of leaving them to the tail of the run. A job costs the wall
+# time of its last run, which $(TIME) appends to its .time log. Jobs never
+# run before are estimated from their IR size plus the summary caches they
+# merge, scaled to seconds by the jobs that have a time.
+def last_time(result):
+    time_log = result.replace('.result', '.time').replace('$(PREFIX)', common_prefix)
+    try:
+        return float(open(time_log).read().split()[-1])
+    except (IOError, ValueError, IndexError):
+        return None
+
+def ir_size(bcs):
+    return sum(os.path.getsize(bc) for bc in bcs if os.path.exists(bc))
+
+estimate = {}
 for scc,bcs in bcs_in_scc.items():
-    bc = scc_to_bc[scc]
-    target = scc_to_result[scc]
+    size = ir_size(bcs)
+    ndeps = len(scc_dep_on[scc] - set([scc]))
+    units = units_in_scc[scc]
+    if not units:
+        estimate[scc_to_result[scc]] = size + dep_cost * ndeps
+        continue
+    # units share the IR of their SCC by instruction count
+    total = sum(unit_cost[u] for u in units) or len(units)
+    for unit in units:
+        share = float(unit_cost[unit] or 1) / total
+        estimate[unit_to_result[unit]] = size * share + dep_cost * (ndeps + len(unit_dep_on[unit]))
+
+timed = dict((job, last_time(job)) for job in estimate)
+timed = dict((job, t) for job, t in timed.items() if t is not None)
+timed_estimate = sum(estimate[job] for job in timed)
+scale = sum(timed.values()) / timed_estimate if timed and timed_estimate else 1.0
+job_cost = dict((job, timed.get(job, estimate[job] * scale)) for job in estimate)
+
+# Rank each SCC by the longest chain of work that waits on it, so that
+# definers with long chains of users are started before isolated SCCs.
+def scc_cost(scc):
+    if units_in_scc[scc]:
+        return sum(job_cost[unit_to_result[u]] for u in units_in_scc[scc])
+    return job_cost[scc_to_result[scc]]
 
+scc_rank = {}
+levels = list(toposort2(dict((k, set(v)) for k,v in scc_dep_on.items())))
+for sccs in reversed(levels):
+    for scc in sccs:
+        users = [scc_rank[u] for u in scc_dep_by[scc] if u != scc]
+        scc_rank[scc] = scc_cost(scc) + max(users or [0])
+for scc in bcs_in_scc:
+    if scc not in scc_rank:
+        scc_rank[scc] = scc_cost(scc)
+result_rank = dict((scc_to_result[scc], r) for scc,r in scc_rank.items())
+
+def by_rank(results):
+    return sorted(results, key=lambda r: result_rank[r], reverse=True)
+
+conn.execute('CREATE TABLE IF NOT EXISTS scc_bc(scc INTEGER, bc TEXT);')
+conn.execute('DELETE FROM scc_bc')
+for scc,bcs in bcs_in_scc.items():
+    if len(bcs) >= 2:
+        conn.execute('INSERT INTO scc_bc VALUES (%d, "%s")' % (scc, scc_to_bc[scc]))
+conn.commit()
+
+# The sensitive set from Makefile.fn also limits the call graph pass: only
+# indirect calls in sensitive functions are refined, the others get the
+# candidates of their function type.
+def print_analysis(target, bc, deps):
     target_deps = target.replace('.result', '.deps')
     time_log = target.replace('.result', '.time')
     out_log = target.replace('.result', '.log')
-    sensilist_phase1 = target.replace('.result', '.sensi1')
-    sensilist_phase2 = target.replace('.result', '.sensi2')
 
-    deps = [scc_to_result[dep] for dep in scc_dep_on[scc] if dep != scc]
     if deps:
         print >> f, ''
         print >> f, '%s: %s' % (target_deps, ' '.join(deps))
@@ -160,44 +251,66 @@ for scc,bcs in bcs_in_scc.items():
     print >> f, '\t@echo RID  $@'
     print >> f, '\t$(V)mkdir -p `dirname $@`'
     if target_deps:
-        print >> f, '\t$(V)opt -analyze -quiet -load $(TOPDIR)/rid.so -rid %s -predefined dpm,ffs -sensilist sensi-list -o-progress -o-test -i-cache %s -o-cache %s -path-type bbpath > %s 2> %s' % (bc, target_deps, target, time_log, out_log)
+        print >> f, '\t$(V)$(TIME) %s opt -analyze -quiet -load $(TOPDIR)/rid.so -rid %s -predefined dpm,ffs -sensilist sensi-list -callgraph-sensilist sensi-list -o-progress -o-test -i-cache %s -o-cache %s -path-type bbpath > %s 2> %s' % (time_log, bc, target_deps, target, time_log, out_log)
     else:
-        print >> f, '\t$(V)opt -analyze -quiet -load $(TOPDIR)/rid.so -rid %s -predefined dpm,ffs -sensilist sensi-list -o-progress -o-test -o-cache %s -path-type bbpath > %s 2> %s' % (bc, target, time_log, out_log)
+        print >> f, '\t$(V)$(TIME) %s opt -analyze -quiet -load $(TOPDIR)/rid.so -rid %s -predefined dpm,ffs -sensilist sensi-list -callgraph-sensilist sensi-list -o-progress -o-test -o-cache %s -path-type bbpath > %s 2> %s' % (time_log, bc, target, time_log, out_log)
 
-    deps = [scc_to_result[dep].replace('.result', '.sensi1') for dep in scc_dep_on[scc] if dep != scc]
-    print >> fnf, ''
-    print >> fnf, '%s: %s %s' % (sensilist_phase1, bc, ' '.join(deps))
-    print >> fnf, '\t@echo FN1   $@'
-    print >> fnf, '\t$(V)mkdir -p `dirname $@`'
-    if deps:
-        print >> fnf, '\t$(V)cat %s | sort | uniq > $@' % ' '.join(deps)
-    else:
-        print >> fnf, '\t$(V)touch $@'
-    print >> fnf, '\t$(V)opt -analyze -quiet -load $(TOPDIR)/rid.so -sensiset1 %s -sensilist $@' % bc
+for scc,bcs in bcs_in_scc.items():
+    bc = scc_to_bc[scc]
+    target = scc_to_result[scc]
+    deps = by_rank([scc_to_result[dep] for dep in scc_dep_on[scc] if dep != scc])
 
-    deps = [scc_to_result[dep].replace('.result', '.sensi2') for dep in scc_dep_by[scc] if dep != scc]
-    deps.append(sensilist_phase1)
-    print >> fnf, ''
-    print >> fnf, '%s: %s %s' % (sensilist_phase2, bc, ' '.join(deps))
-    print >> fnf, '\t@echo FN2   $@'
-    print >> fnf, '\t$(V)mkdir -p `dirname $@`'
-    print >> fnf, '\t$(V)cat %s | sort | uniq > $@' % ' '.join(deps)
-    print >> fnf, '\t$(V)opt -analyze -quiet -load $(TOPDIR)/rid.so -sensiset2 %s -sensilist $@' % bc
+    if not units_in_scc[scc]:
+        print_analysis(target, bc, deps)
+        continue
 
-    scc_to_result[scc] = target
+    # Each unit is extracted from the linked SCC module and analyzed on its
+    # own; calls into other units are resolved through their summaries.
+    units = sorted(units_in_scc[scc], key=lambda u: job_cost[unit_to_result[u]], reverse=True)
+    for unit in units:
+        unit_bc = unit_to_result[unit].replace('.result', '.bc')
+        print >> f, ''
+        print >> f, '%s: %s' % (unit_bc, bc)
+        print >> f, '\t@echo EXTR $@'
+        print >> f, '\t$(V)mkdir -p `dirname $@`'
+        print >> f, '\t$(V)llvm-extract %s -o $@ $<' % ' '.join('-func=%s' % fn for fn in unit_fns[unit])
+        unit_deps = deps + [unit_to_result[dep] for dep in unit_dep_on[unit]]
+        print_analysis(unit_to_result[unit], unit_bc, unit_deps)
+
+    print >> f, ''
+    print >> f, '%s: %s' % (target, ' '.join(unit_to_result[u] for u in units))
+    print >> f, '\t@echo MERG $@'
+    print >> f, '\t$(V)$(TOPDIR)/cache-merge -o-cache $@ $+'
 
 print >> f, ''
-print >> f, 'all: %s' % ' '.join(scc_to_result.values())
+print >> f, 'all: %s' % ' '.join(by_rank(scc_to_result.values()))
+
+print 'estimated work %.0f, longest chain %.0f (%d of %d jobs timed)' % \
+    (sum(job_cost.values()), max(scc_rank.values() or [0]), len(timed), len(job_cost))
 
 print >> sccf, 'all: %s' % ' '.join(to_be_linked)
 
-sources = []
-for scc,bcs in bcs_in_scc.items():
-    if not scc_dep_on[scc]:
-        sources.append(scc_to_result[scc].replace('.result', '.sensi2'))
+# The sensitive set is computed in a single opt run over the whole kernel,
+# which propagates in both directions on the condensed call graph at once.
+# Out-of-core, rsc-sensiset does the same without linking, holding one
+# file at a time.
+all_bcs = [bc for bcs in bcs_in_scc.values() for bc in bcs]
 print >> fnf, ''
-print >> fnf, 'all:', ' '.join(sources)
-print >> fnf, '\t$(V)cat %s | sort | uniq > sensi-list' % ' '.join(sources)
+print >> fnf, 'all: sensi-list'
+if out_of_core:
+    print >> fnf, ''
+    print >> fnf, 'sensi-list: %s' % ' '.join(all_bcs).replace(common_prefix, '$(PREFIX)')
+    print >> fnf, '\t@echo FN   $@'
+    print >> fnf, '\t$(V)$(TOPDIR)/rsc-sensiset -o $@ $+'
+else:
+    print >> fnf, ''
+    print >> fnf, 'linux.bc: %s' % ' '.join(all_bcs).replace(common_prefix, '$(PREFIX)')
+    print >> fnf, '\t@echo LINK $@'
+    print >> fnf, '\t$(V)llvm-link -o $@ $+'
+    print >> fnf, ''
+    print >> fnf, 'sensi-list: linux.bc'
+    print >> fnf, '\t@echo FN   $@'
+    print >> fnf, '\t$(V)opt -analyze -quiet -load $(TOPDIR)/rsc.so -sensiset $< -o-sensiset $@'
 
 for sccs in toposort2(scc_dep_on):
     for scc in sccs:
@@ -14,32 +14,40 @@ class SCC(object):
         id2stacki = {}
         sccs = []
 
-        def dfs(v, vid):
-            id2dfsnum[vid] = id2lowest[vid] = v_dfsnum = get_dfsnum()
+        def visit(v, vid):
+            id2dfsnum[vid] = id2lowest[vid] = get_dfsnum()
             id2stacki[vid] = len(stack)
             stack.append((v, vid))
-            for w in successors(v):
-                wid = node2id(w)
-                if wid not in id2dfsnum:   # first time we saw w
-                    dfs(w, wid)
-                    id2lowest[vid] = min(id2lowest[vid], id2lowest[wid])
-                else:
+            return (v, vid, iter(successors(v)))
+
+        # Tarjan with an explicit stack, call graphs are deeper than the
+        # recursion limit
+        for root in roots:
+            if node2id(root) in id2dfsnum:
+                continue
+            work = [visit(root, node2id(root))]
+            while work:
+                v, vid, succs = work[-1]
+                for w in succs:
+                    wid = node2id(w)
+                    if wid not in id2dfsnum:   # first time we saw w
+                        work.append(visit(w, wid))
+                        break
                     w_dfsnum = id2dfsnum[wid]
-                    if w_dfsnum < v_dfsnum and wid in id2stacki:
+                    if w_dfsnum < id2dfsnum[vid] and wid in id2stacki:
                         id2lowest[vid] = min(id2lowest[vid], w_dfsnum)
-
-            if id2lowest[vid] == v_dfsnum:
-                i = id2stacki[vid]
-                scc = []
-                for w, wid in stack[i:]:
-                    del id2stacki[wid]
-                    scc.append(w)
-                del stack[i:]
-                sccs.append(scc)
-
-        for v in roots:
-            vid = node2id(v)
-            if vid not in id2dfsnum:
-                dfs(v, vid)
+                else:
+                    work.pop()
+                    if work:
+                        pid = work[-1][1]
+                        id2lowest[pid] = min(id2lowest[pid], id2lowest[vid])
+                    if id2lowest[vid] == id2dfsnum[vid]:
+                        i = id2stacki[vid]
+                        scc = []
+                        for w, wid in stack[i:]:
+                            del id2stacki[wid]
+                            scc.append(w)
+                        del stack[i:]
+                        sccs.append(scc)
         sccs.reverse()
         return sccs
@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Time the analyze.sh stages on synthetic kernel-like corpora generated by
+# rsc-gen, and measure the recall of the bugs planted in them.
+#
+# usage: scripts/bench-pipeline.sh [function counts...]
+#
+# Run from the directory of analyze.sh, after "make install". Results are
+# appended to $BENCH_DIR/results.csv as size,stage,seconds,status.
+#
+
+SIZES=${@:-10000 100000 1000000}
+CURRENT_DIR=`pwd`
+BENCH_DIR=${BENCH_DIR:-$CURRENT_DIR/bench}
+GEN_FLAGS=${GEN_FLAGS:-}
+
+if [[ ! -x $CURRENT_DIR/rsc-gen || ! -f $CURRENT_DIR/rsc.so ]]; then
+    echo "Please build and install rsc.so and rsc-gen first!"
+    exit 1
+fi
+
+mkdir -p $BENCH_DIR
+RESULTS=$BENCH_DIR/results.csv
+
+for n in $SIZES; do
+    work=$BENCH_DIR/n$n
+    rm -rf $work
+    $CURRENT_DIR/rsc-gen -o $work -functions $n $GEN_FLAGS || exit 1
+    cp $CURRENT_DIR/scripts/inline-list $work
+
+    # The corpus is its own "kernel": bitcodes are already in place
+    cat > $work/config <<EOC
+KERNEL_DIR=$work
+BUILD_DIR=.
+WORK_DIR=$work
+SKIP_PATHS=()
+EOC
+
+    for stage in prepare run report; do
+	start=`date +%s.%N`
+	RSC_CONFIG=$work/config ./analyze.sh $stage > $work/$stage.log 2>&1
+	status=$?
+	end=`date +%s.%N`
+	secs=`echo "$end - $start" | bc`
+	echo "$n,$stage,$secs,$status" | tee -a $RESULTS
+    done
+
+    # Recall of the planted bugs by the rsc pass on the linked corpus
+    start=`date +%s.%N`
+    llvm-link `cat $work/abs_bclist` -o $work/linked.bc
+    opt -analyze -quiet -load $CURRENT_DIR/rsc.so -rsc $work/linked.bc > $work/rsc.log 2> /dev/null
+    status=$?
+    end=`date +%s.%N`
+    secs=`echo "$end - $start" | bc`
+    echo "$n,rsc,$secs,$status" | tee -a $RESULTS
+
+    found=`grep -o "^sleep-in-atomic: [^ ]*" $work/rsc.log | cut -d' ' -f2 | sort -u \
+	| comm -12 - <(sort -u $work/planted-bugs) | wc -l`
+    total=`sort -u $work/planted-bugs | wc -l`
+    echo "$n: found $found of $total planted bugs"
+done
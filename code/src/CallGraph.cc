@@ -1,18 +1,169 @@
-#include <llvm/DebugInfo.h>
+#include <llvm/IR/DebugInfo.h>
 #include <llvm/Pass.h>
-#include <llvm/Instructions.h>
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/Support/Debug.h>
-#include <llvm/Support/InstIterator.h>
-#include <llvm/Module.h>
-#include <llvm/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/Analysis/CallGraph.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <omp.h>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <utility>
+#include <vector>
 
 #include "rsc_CallGraph.h"
 #include "rsc_utils.h"
+#include "util.h"
+#include "Trace.h"
 
 using namespace llvm;
 
+cl::opt<bool>
+UnifyFuncPtrs("fp-unify",
+	      cl::init(false),
+	      cl::desc("Resolve function pointers by unification (fast, less precise)"));
+
+static cl::opt<std::string>
+RefineList("callgraph-sensilist",
+	   cl::init(""),
+	   cl::desc("Only refine indirect calls in these functions, resolve the rest by type"));
+
+// A module loaded into a context that already has a struct of the same
+// name gets it renamed apart (struct.foo.12); drop these suffixes. Numbered
+// anonymous structs of one module (struct.anon.0) fall together as well.
+static std::string stripRenames(StringRef Str) {
+	std::string Out;
+	for (size_t i = 0; i != Str.size(); ) {
+		size_t j = i + 1;
+		if (Str[i] == '.')
+			while (j != Str.size() && isdigit(Str[j]))
+				++j;
+		bool Suffix = j > i + 1 && (j == Str.size() ||
+		              !(isalnum(Str[j]) || Str[j] == '_' || Str[j] == '.'));
+		if (!Suffix)
+			Out.append(Str.data() + i, j - i);
+		i = j;
+	}
+	return Out;
+}
+
+// The key of a function type in TypeFuncs. In-core, all modules share
+// one context and the type is its own key. With stand-ins, modules come
+// and go, in contexts of their own or reloaded into one that renames their
+// structs apart (struct.foo.12), so the key is the printed form of the
+// type without these suffixes, interned in TypeNames. Without Insert, a
+// type no address-taken function has is NULL, and lookups stay safe to
+// run concurrently.
+const void *CallGraphPass::typeKey(FunctionType *FTy, bool Insert) {
+	if (!StandIns)
+		return FTy;
+
+	std::string Str;
+	raw_string_ostream OS(Str);
+	FTy->print(OS);
+	OS.flush();
+	std::string Key = stripRenames(Str);
+
+	if (Insert)
+		return TypeNames.insert(Key).first->getKeyData();
+	StringSet<>::const_iterator it = TypeNames.find(Key);
+	return it == TypeNames.end() ? NULL : it->getKeyData();
+}
+
+// the key of the functions a value of type Ty points to, NULL if Ty is
+// not a function pointer type
+const void *CallGraphPass::calleeTypeKey(Type *Ty) {
+	PointerType *PTy = dyn_cast<PointerType>(Ty);
+	if (!PTy)
+		return NULL;
+	FunctionType *FTy = dyn_cast<FunctionType>(PTy->getElementType());
+	if (!FTy)
+		return NULL;
+	return typeKey(FTy, false);
+}
+
+// address-taken functions whose type matches a function pointer type
+FuncSetRef CallGraphPass::getTypeCandidates(Type *Ty) {
+	return getTypeCandidates(calleeTypeKey(Ty));
+}
+
+FuncSetRef CallGraphPass::getTypeCandidates(const void *Key) {
+	if (!Key)
+		return FuncSetRef();
+	TypeFuncMap::const_iterator it = Ctx->TypeFuncs.find(Key);
+	if (it == Ctx->TypeFuncs.end())
+		return FuncSetRef();
+	return it->second;
+}
+
+// Out-of-core or across reload(), the sets outlive the modules their
+// functions come from, so they hold resident stand-ins instead: one
+// declaration per scope name, whose getArgId() and getRetId() match those
+// of the original. The stand-in of a defined function gets a body, so
+// that empty() still tells definitions apart.
+Function *CallGraphPass::canon(Function *F) {
+	if (!StandIns)
+		return F;
+
+	Function *C;
+	#pragma omp critical(rsc_canon)
+	{
+		if (!Ctx->StubModule) {
+			Ctx->StubContext.reset(new LLVMContext());
+			Ctx->StubModule.reset(new Module("rsc.stubs", *Ctx->StubContext));
+		}
+		LLVMContext &SC = *Ctx->StubContext;
+		std::string Name = getScopeName(F);
+		C = Ctx->StubModule->getFunction(Name);
+		if (!C)
+			C = Function::Create(FunctionType::get(Type::getVoidTy(SC), false),
+			                     GlobalValue::ExternalLinkage, Name,
+			                     Ctx->StubModule.get());
+		if (C->empty() && !F->empty())
+			new UnreachableInst(SC, BasicBlock::Create(SC, "", C));
+	}
+	return C;
+}
+
+// whether indirect calls in F take part in the fixpoint refinement
+bool CallGraphPass::isRefined(Function *F) {
+	return Refined.empty() || Refined.count(F->getName());
+}
+
+// address-taken declarations are indexed by their definitions, which are
+// only known once all modules are initialized
+void CallGraphPass::resolvePendingDecls() {
+	for (unsigned i = 0; i != PendingDecls.size(); ++i) {
+		FuncMap::iterator it = Ctx->Funcs.find(PendingDecls[i].first);
+		if (it == Ctx->Funcs.end())
+			continue;
+		InitTypeFuncs[PendingDecls[i].second].insert(it->second);
+	}
+	PendingDecls.clear();
+}
+
+void CallGraphPass::internInitSets() {
+	resolvePendingDecls();
+	for (std::map<std::string, FuncSet>::iterator i = InitFuncPtrs.begin(),
+	     e = InitFuncPtrs.end(); i != e; ++i)
+		Ctx->FuncPtrs[i->first] = Ctx->FuncSets.get(i->second);
+	for (DenseMap<const void *, FuncSet>::iterator i = InitTypeFuncs.begin(),
+	     e = InitTypeFuncs.end(); i != e; ++i)
+		Ctx->TypeFuncs[i->first] = Ctx->FuncSets.get(i->second);
+	InitFuncPtrs.clear();
+	InitTypeFuncs.clear();
+	Interned = true;
+}
+
 // collect function pointer assignments in global initializers
 void
 CallGraphPass::processInitializers(Module *M, Constant *I, GlobalValue *V) {
@@ -30,7 +181,7 @@ CallGraphPass::processInitializers(Module *M, Constant *I, GlobalValue *V) {
 				// found function pointers in struct fields
 				if (Function *F = dyn_cast<Function>(CS->getOperand(i))) {
 					std::string Id = getStructId(STy, M, i);
-					Ctx->FuncPtrs[Id].insert(F);
+					addInit(Id, canon(F));
 				}
 			}
 		}
@@ -43,7 +194,7 @@ CallGraphPass::processInitializers(Module *M, Constant *I, GlobalValue *V) {
 		// global function pointer variables
 		if (V) {
 			std::string Id = getVarId(V);
-			Ctx->FuncPtrs[Id].insert(F);
+			addInit(Id, canon(F));
 		}
 	}
 }
@@ -55,91 +206,207 @@ bool CallGraphPass::mergeFuncSet(FuncSet &S, const std::string &Id) {
 	return false;
 }
 
-bool CallGraphPass::mergeFuncSet(FuncSet &Dst, const FuncSet &Src) {
+bool CallGraphPass::mergeFuncSet(FuncSet &Dst, FuncSetRef Src) {
 	bool Changed = false;
-	for (FuncSet::const_iterator i = Src.begin(), e = Src.end(); i != e; ++i)
-		Changed |= Dst.insert(*i);
+	for (FuncSetRef::iterator i = Src.begin(), e = Src.end(); i != e; ++i)
+		Changed |= Dst.insert(*i).second;
 	return Changed;
 }
 
+// Dst = Dst + Src, sharing the interned result
+bool CallGraphPass::mergeFuncSet(FuncSetRef &Dst, FuncSetRef Src) {
+	FuncSetRef R = Ctx->FuncSets.unite(Dst, Src);
+	if (R == Dst)
+		return false;
+	Dst = R;
+	return true;
+}
+
 
+// S = S + FuncPtrs[Id], or the candidates of type Ty if nothing reached Id
+bool CallGraphPass::mergeFuncSetOrType(FuncSet &S, const std::string &Id,
+                                       Type *Ty) {
+	FuncPtrMap::iterator i = Ctx->FuncPtrs.find(Id);
+	if (i != Ctx->FuncPtrs.end() && !i->second.empty())
+		return mergeFuncSet(S, i->second);
+	return mergeFuncSet(S, getTypeCandidates(Ty));
+}
+
+// every source of V that resolves to nothing falls back to the type
+// candidates of Ty, the type V is called as
 bool CallGraphPass::findFunctions(Value *V, FuncSet &S) {
 	SmallPtrSet<Value *, 4> Visited;
-	return findFunctions(V, S, Visited);
+	return findFunctions(V, S, V->getType(), Visited);
 }
 
-bool CallGraphPass::findFunctions(Value *V, FuncSet &S, 
+bool CallGraphPass::findFunctions(Value *V, FuncSet &S, Type *Ty,
                                   SmallPtrSet<Value *, 4> Visited) {
-	if (!Visited.insert(V))
+	if (!Visited.insert(V).second)
 		return false;
 
 	// real function, S = S + {F}
 	if (Function *F = dyn_cast<Function>(V)) {
 		if (!F->empty())
-			return S.insert(F);
+			return S.insert(canon(F)).second;
 
 		// prefer the real definition to declarations
 		FuncMap::iterator it = Ctx->Funcs.find(F->getName());
 		if (it != Ctx->Funcs.end())
-			return S.insert(it->second);
+			return S.insert(it->second).second;
 		else
-			return S.insert(F);
+			return S.insert(canon(F)).second;
 	}
 
 	// bitcast, ignore the cast
 	if (BitCastInst *B = dyn_cast<BitCastInst>(V))
-		return findFunctions(B->getOperand(0), S, Visited);
+		return findFunctions(B->getOperand(0), S, Ty, Visited);
 	
 	// const bitcast, ignore the cast
 	if (ConstantExpr *C = dyn_cast<ConstantExpr>(V)) {
 		if (C->isCast())
-			return findFunctions(C->getOperand(0), S, Visited);
+			return findFunctions(C->getOperand(0), S, Ty, Visited);
 	}
 	
 	// PHI node, recursively collect all incoming values
 	if (PHINode *P = dyn_cast<PHINode>(V)) {
 		bool Changed = false;
 		for (unsigned i = 0; i != P->getNumIncomingValues(); ++i)
-			Changed |= findFunctions(P->getIncomingValue(i), S, Visited);
+			Changed |= findFunctions(P->getIncomingValue(i), S, Ty, Visited);
 		return Changed;
 	}
 	
 	// select, recursively collect both paths
 	if (SelectInst *SI = dyn_cast<SelectInst>(V)) {
 		bool Changed = false;
-		Changed |= findFunctions(SI->getTrueValue(), S, Visited);
-		Changed |= findFunctions(SI->getFalseValue(), S, Visited);
+		Changed |= findFunctions(SI->getTrueValue(), S, Ty, Visited);
+		Changed |= findFunctions(SI->getFalseValue(), S, Ty, Visited);
 		return Changed;
 	}
 	
 	// arguement, S = S + FuncPtrs[arg.ID]
 	if (Argument *A = dyn_cast<Argument>(V))
-		return mergeFuncSet(S, getArgId(A));
+		return mergeFuncSetOrType(S, getArgId(A), Ty);
 	
 	// return value, S = S + FuncPtrs[ret.ID]
 	if (CallInst *CI = dyn_cast<CallInst>(V)) {
 		if (Function *CF = CI->getCalledFunction())
-			return mergeFuncSet(S, getRetId(CF));
+			return mergeFuncSetOrType(S, getRetId(CF), Ty);
 
-		// TODO: handle indirect calls
-		return false;
+		// returned by an indirect call, fall back to the type index
+		return mergeFuncSet(S, getTypeCandidates(CI->getType()));
 	}
 	
-	// loads, S = S + FuncPtrs[struct.ID]
-	if (LoadInst *L = dyn_cast<LoadInst>(V))
-		return mergeFuncSet(S, getLoadStoreId(L));
+	// loads, S = S + FuncPtrs[struct.ID], by type if the load has no key
+	if (LoadInst *L = dyn_cast<LoadInst>(V)) {
+		StringRef Id = getLoadStoreId(L, IdKind);
+		if (Id.empty())
+			return mergeFuncSet(S, getTypeCandidates(L->getType()));
+		return mergeFuncSetOrType(S, Id.str(), Ty);
+	}
+
+	// inttoptr, nothing to track
+	if (IntToPtrInst *IP = dyn_cast<IntToPtrInst>(V))
+		return mergeFuncSet(S, getTypeCandidates(IP->getType()));
 	
-	// ignore other constant (usually null), inline asm and inttoptr
-	if (isa<Constant>(V) || isa<InlineAsm>(V) || isa<IntToPtrInst>(V))
+	// ignore other constant (usually null) and inline asm
+	if (isa<Constant>(V) || isa<InlineAsm>(V))
 		return false;
 		
-	V->dump();
+	errs() << *V << "\n";
 	report_fatal_error("findFunctions: unhandled value type\n");
 	return false;
 }
 
+// Dst = V, as constraints from the keys V flows from
+void CallGraphPass::addFlow(unsigned Dst, Value *V) {
+	FuncSet S;
+	std::vector<std::string> Keys;
+	SmallPtrSet<Value *, 4> Visited;
+	collectSources(V, S, Keys, Visited);
+
+	for (unsigned i = 0; i != Keys.size(); ++i)
+		addCopy(Solver.getNode(Keys[i]), Dst);
+	addBase(Dst, Ctx->FuncSets.get(S));
+}
+
+// arg.F.No >= Srcs + Base for every F in Callees
+void CallGraphPass::addArgFlows(FuncSetRef Callees, unsigned No,
+                                const std::vector<unsigned> &Srcs,
+                                FuncSetRef Base) {
+	for (FuncSetRef::iterator i = Callees.begin(), e = Callees.end();
+	     i != e; ++i) {
+		unsigned Dst = Solver.getNode(getArgId(*i, No));
+		for (unsigned k = 0; k != Srcs.size(); ++k)
+			addCopy(Srcs[k], Dst);
+		addBase(Dst, Base);
+	}
+}
+
+// The constraints below go to the solver unless Apply is off, and into
+// the records of the current module if there is one, see reload().
+void CallGraphPass::addInit(const std::string &Id, Function *F) {
+	if (Cur)
+		Cur->Inits.push_back(std::make_pair(Id, F));
+	if (Apply)
+		InitFuncPtrs[Id].insert(F);
+}
+
+void CallGraphPass::addBase(unsigned Dst, FuncSetRef S) {
+	if (S.empty())
+		return;
+	if (Cur)
+		Cur->Bases.push_back(std::make_pair(Dst, S));
+	if (Apply)
+		Solver.addBase(Dst, S);
+}
+
+void CallGraphPass::addCopy(unsigned Src, unsigned Dst) {
+	if (Cur)
+		Cur->Copies.push_back(std::make_pair(Src, Dst));
+	if (Apply)
+		Solver.addCopy(Src, Dst);
+}
+
+void CallGraphPass::addCall(const FallbackArg &FA) {
+	if (Cur)
+		Cur->Calls.push_back(FA);
+	if (Apply) {
+		Solver.addCall(FA.Key, FA.No, FA.Srcs, FA.Base);
+		FallbackArgs.push_back(FA);
+	}
+}
+
+// the type fallback of FA if its key is empty; not a constraint of any
+// module, so nothing is recorded
+bool CallGraphPass::addTypeFallback(const FallbackArg &FA) {
+	if (!Solver.getPts(FA.Key).empty())
+		return false;
+	ModuleCons *Saved = Cur;
+	Cur = NULL;
+	addArgFlows(getTypeCandidates(FA.TyKey), FA.No, FA.Srcs, FA.Base);
+	Cur = Saved;
+	return true;
+}
+
+// Once all constraints are in and the sets are final, a call through a
+// key that is still empty resolves to the type candidates (see
+// findFunctions), so they receive its function pointer arguments too.
+// Sets only grow, hence this is done once.
+bool CallGraphPass::applyFallbackArgs() {
+	for (unsigned i = 0; i != FallbackArgs.size(); ++i)
+		addTypeFallback(FallbackArgs[i]);
+	std::vector<FallbackArg>().swap(FallbackArgs);
+	return Solver.solve();
+}
+
+// The constraints of a function never change, so they are extracted once
+// and the solver only propagates what is new.
 bool CallGraphPass::runOnFunction(Function *F) {
-	bool Changed = false;
+	if (UnifyFuncPtrs)
+		return unifyOnFunction(F);
+
+	if (F->empty() || !Extracted.insert(F).second)
+		return false;
 
 	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
 		Instruction *I = &*i;
@@ -147,27 +414,33 @@ bool CallGraphPass::runOnFunction(Function *F) {
 			// stores to function pointers
 			Value *V = SI->getValueOperand();
 			if (isFunctionPointer(V->getType())) {
-				StringRef Id = getLoadStoreId(SI);
+				StringRef Id = getLoadStoreId(SI, IdKind);
 				if (!Id.empty())
-					Changed |= findFunctions(V, Ctx->FuncPtrs[Id]);
+					addFlow(Solver.getNode(Id.str()), V);
 			}
 		} else if (ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
 			// function returns
-			if (isFunctionPointer(F->getReturnType())) {
-				Value *V = RI->getReturnValue();
-				std::string Id = getRetId(F);
-				Changed |= findFunctions(V, Ctx->FuncPtrs[Id]);
-			}
+			if (isFunctionPointer(F->getReturnType()))
+				addFlow(Solver.getNode(getRetId(F)),
+					RI->getReturnValue());
 		} else if (CallInst *CI = dyn_cast<CallInst>(I)) {
 			// ignore inline asm or intrinsic calls
 			if (CI->isInlineAsm() || (CI->getCalledFunction()
 					&& CI->getCalledFunction()->isIntrinsic()))
 				continue;
 
-			// might be an indirect call, find all possible callees
+			// might be an indirect call, find all possible callees;
+			// outside the refined set they are the type candidates
+			Value *CV = CI->getCalledValue();
+			bool Typed = !CI->getCalledFunction() && !isRefined(F);
 			FuncSet FS;
-			if (!findFunctions(CI->getCalledValue(), FS))
-				continue;
+			std::vector<std::string> CKeys;
+			SmallPtrSet<Value *, 4> CVisited;
+			if (Typed)
+				mergeFuncSet(FS, getTypeCandidates(CV->getType()));
+			else
+				collectSources(CV, FS, CKeys, CVisited);
+			FuncSetRef FR = Ctx->FuncSets.get(FS);
 
 			// looking for function pointer arguments
 			for (unsigned no = 0; no != CI->getNumArgOperands(); ++no) {
@@ -177,55 +450,278 @@ bool CallGraphPass::runOnFunction(Function *F) {
 
 				// find all possible assignments to the argument
 				FuncSet VS;
-				if (!findFunctions(V, VS))
-					continue;
+				std::vector<std::string> VKeys;
+				SmallPtrSet<Value *, 4> VVisited;
+				collectSources(V, VS, VKeys, VVisited);
 
-				// update argument FP-set for possible callees
-				for (FuncSet::iterator k = FS.begin(), ke = FS.end();
-				        k != ke; ++k) {
-					llvm::Function *CF = *k;
-					std::string Id = getArgId(CF, no);
-					Changed |= mergeFuncSet(Ctx->FuncPtrs[Id], VS);
+				std::vector<unsigned> Srcs;
+				for (unsigned k = 0; k != VKeys.size(); ++k)
+					Srcs.push_back(Solver.getNode(VKeys[k]));
+				FuncSetRef VR = Ctx->FuncSets.get(VS);
+
+				// known callees get the argument right away
+				addArgFlows(FR, no, Srcs, VR);
+
+				// callees through function pointers as they are found,
+				// or by type if a pointer has none at the fixpoint
+				for (unsigned k = 0; k != CKeys.size(); ++k) {
+					FallbackArg FA;
+					FA.Key = Solver.getNode(CKeys[k]);
+					FA.No = no;
+					FA.TyKey = calleeTypeKey(CV->getType());
+					FA.Srcs = Srcs;
+					FA.Base = VR;
+					addCall(FA);
 				}
 			}
 		}
 	}
-	return Changed;
+	return true;
+}
+
+// the key of the memory a function pointer is loaded from or stored to:
+// a global variable or a field of a named struct, whose name is taken
+// without renaming suffixes if Strip
+static std::string getPointerId(Value *P, Module *M, bool Strip) {
+	P = P->stripPointerCasts();
+	if (GlobalVariable *GV = dyn_cast<GlobalVariable>(P))
+		return getVarId(GV);
+
+	GEPOperator *GEP = dyn_cast<GEPOperator>(P);
+	if (!GEP)
+		return "";
+	StructType *STy = NULL;
+	unsigned Field = 0;
+	for (gep_type_iterator i = gep_type_begin(GEP), e = gep_type_end(GEP);
+	     i != e; ++i) {
+		// only the last index selects the field
+		STy = i.getStructTypeOrNull();
+		if (STy)
+			Field = cast<ConstantInt>(i.getOperand())->getZExtValue();
+	}
+	if (!STy || STy->isLiteral())
+		return "";
+	if (!Strip)
+		return getStructId(STy, M, Field);
+	return stripRenames(getScopeName(STy, M)) + "." + Twine(Field).str();
+}
+
+// tag function pointer loads and stores with their keys, unless the
+// bitcode already carries them
+void CallGraphPass::annotateLoadStores(Module *M) {
+	LLVMContext &C = M->getContext();
+	for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+		for (inst_iterator i = inst_begin(&*f), e = inst_end(&*f); i != e; ++i) {
+			Instruction *I = &*i;
+			Value *P = NULL;
+			if (LoadInst *L = dyn_cast<LoadInst>(I)) {
+				if (isFunctionPointer(L->getType()))
+					P = L->getPointerOperand();
+			} else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+				if (isFunctionPointer(SI->getValueOperand()->getType()))
+					P = SI->getPointerOperand();
+			}
+			if (!P || I->getMetadata(IdKind))
+				continue;
+			std::string Id = getPointerId(P, M, StandIns);
+			if (!Id.empty())
+				I->setMetadata(IdKind, MDNode::get(C, MDString::get(C, Id)));
+		}
+	}
 }
 
 bool CallGraphPass::doInitialization(Module *M) {
+	if (!RefineList.empty() && Refined.empty()
+	    && !rsc::readFunctionList(RefineList, Refined))
+		errs() << "Cannot open " << RefineList << "\n";
+
+	IdKind = M->getContext().getMDKindID(MD_ID);
+	annotateLoadStores(M);
+	++NumModules;
+	if (KeepCons) {
+		ModuleIds[M] = Cons.size();
+		Cons.push_back(ModuleCons());
+		Cur = &Cons.back();
+	}
+
 	// collect function pointer assignments in global initializers
 	Module::global_iterator i, e;
 	for (i = M->global_begin(), e = M->global_end(); i != e; ++i) {
 		if (i->hasInitializer())
 			processInitializers(M, i->getInitializer(), &*i);
 	}
+	Cur = NULL;
+
+	// collect global function definitions; out-of-core, this is also
+	// where the stand-ins of all defined functions get their body
+	for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+		if (f->empty())
+			continue;
+		Function *C = canon(&*f);
+		if (f->hasExternalLinkage())
+			Ctx->Funcs[C->getName()] = C;
+	}
 
-	// collect global function definitions
+	// index address-taken functions by type, as the fallback for call
+	// sites the fixpoint leaves unresolved
 	for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
-		if (f->hasExternalLinkage() && !f->empty())
-			Ctx->Funcs[f->getName()] = &*f;
+		if (!f->hasAddressTaken() || f->isIntrinsic())
+			continue;
+		const void *K = typeKey(f->getFunctionType(), true);
+		if (f->empty()) {
+			PendingDecls.push_back(std::make_pair(f->getName().str(), K));
+			continue;
+		}
+		InitTypeFuncs[K].insert(canon(&*f));
 	}
 
 	return true;
 }
 
+// the callees of CI, a call in F
+void CallGraphPass::resolveCall(Function *F, CallInst *CI, FuncSet &FS) {
+	Value *CV = CI->getCalledValue();
+	bool Indirect = !CI->getCalledFunction() && !CI->isInlineAsm();
+
+	// tier 1: outside the refined set, type candidates only
+	if (Indirect && !isRefined(F)) {
+		mergeFuncSet(FS, getTypeCandidates(CV->getType()));
+		return;
+	}
+
+	// tier 2: fixpoint result, type candidates for every source it
+	// leaves empty
+	findFunctions(CV, FS);
+	if (Indirect && FS.empty())
+		mergeFuncSet(FS, getTypeCandidates(CV->getType()));
+}
+
 bool CallGraphPass::doFinalization(Module *M) {
-	// update callee mapping
-	for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
-		Function *F = &*f;
+	typedef std::vector<std::pair<CallInst *, FuncSet> > CalleeBuffer;
+	typedef std::vector<std::pair<CallInst *, std::vector<std::string> > >
+		KeyBuffer;
+
+	if (!Interned)
+		internInitSets();
+
+	// publish the solver state as ordinary FuncPtrs entries
+	if (!Materialized) {
+		if (UnifyFuncPtrs)
+			materializeClasses();
+		else
+			Solver.writeBack();
+		Materialized = true;
+	}
+
+	std::vector<Function *> Fs;
+	for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f)
+		Fs.push_back(&*f);
+
+	// FuncPtrs is read-only after the fixpoint, so call sites of different
+	// functions are resolved concurrently into per-thread buffers; the
+	// metadata kind is resolved here, as lookups by name are not thread-safe
+	IdKind = M->getContext().getMDKindID(MD_ID);
+	if (OutOfCore)
+		annotateLoadStores(M);
+	std::vector<CalleeBuffer> Buffers(omp_get_max_threads());
+	std::vector<KeyBuffer> KeyBuffers(KeepCons ? Buffers.size() : 0);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (long k = 0; k < (long)Fs.size(); ++k) {
+		CalleeBuffer &Buf = Buffers[omp_get_thread_num()];
+		Function *F = Fs[k];
+		rsc::trace::Span T(F->getName(), rsc::trace::FUNCTION);
 		for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
 			// map callsite to possible callees
 			if (CallInst *CI = dyn_cast<CallInst>(&*i)) {
-				FuncSet &FS = Ctx->Callees[CI];
-				findFunctions(CI->getCalledValue(), FS);
+				Buf.push_back(std::make_pair(CI, FuncSet()));
+				resolveCall(F, CI, Buf.back().second);
+
+				// the keys a refined indirect call reads, see reload()
+				if (!KeepCons || CI->getCalledFunction()
+				    || CI->isInlineAsm() || !isRefined(F))
+					continue;
+				FuncSet S;
+				std::vector<std::string> Keys;
+				SmallPtrSet<Value *, 4> Visited;
+				collectSources(CI->getCalledValue(), S, Keys, Visited);
+				if (!Keys.empty())
+					KeyBuffers[omp_get_thread_num()].push_back(
+						std::make_pair(CI, Keys));
 			}
 		}
 	}
+
+	for (unsigned t = 0; t != KeyBuffers.size(); ++t) {
+		KeyBuffer &Buf = KeyBuffers[t];
+		for (KeyBuffer::iterator i = Buf.begin(), e = Buf.end(); i != e; ++i)
+			SiteKeys[i->first].swap(i->second);
+	}
+
+	// update callee mapping, interning is not thread-safe
+	if (!OutOfCore) {
+		for (unsigned t = 0; t != Buffers.size(); ++t) {
+			CalleeBuffer &Buf = Buffers[t];
+			for (CalleeBuffer::iterator i = Buf.begin(), e = Buf.end(); i != e; ++i)
+				Ctx->Callees[i->first] = Ctx->FuncSets.get(i->second);
+		}
+		return false;
+	}
+
+	// out-of-core, the call instructions go away with the module, so its
+	// part of the call graph is added right away, over the stand-ins and
+	// in module order as in buildCallGraph()
+	DenseMap<CallInst *, FuncSetRef> Resolved;
+	for (unsigned t = 0; t != Buffers.size(); ++t) {
+		CalleeBuffer &Buf = Buffers[t];
+		for (CalleeBuffer::iterator i = Buf.begin(), e = Buf.end(); i != e; ++i)
+			Resolved[i->first] = Ctx->FuncSets.get(i->second);
+	}
+	rsc::CallGraphCSR &CG = Ctx->CallGraph;
+	for (unsigned k = 0; k != Fs.size(); ++k)
+		CG.add_function(canon(Fs[k]));
+	for (unsigned k = 0; k != Fs.size(); ++k) {
+		Function *C = canon(Fs[k]);
+		for (inst_iterator i = inst_begin(Fs[k]), e = inst_end(Fs[k]);
+		     i != e; ++i) {
+			CallInst *CI = dyn_cast<CallInst>(&*i);
+			if (!CI || isa<IntrinsicInst>(CI))
+				continue;
+			rsc::CallGraphCSR::SiteId S = CG.add_site(C);
+			FuncSetRef v = Resolved[CI];
+			for (FuncSetRef::iterator j = v.begin(), je = v.end(); j != je; ++j)
+				CG.add_edge(S, *j);
+		}
+	}
 	return false;
 }
 
 bool CallGraphPass::doModulePass(Module *M) {
+	if (!Interned)
+		internInitSets();
+
+	// a fresh load has neither the annotations of the last one nor its
+	// addresses, which functions of this module may reuse
+	if (OutOfCore) {
+		IdKind = M->getContext().getMDKindID(MD_ID);
+		annotateLoadStores(M);
+		Extracted.clear();
+	}
+
+	if (!UnifyFuncPtrs) {
+		// extract new constraints, then propagate the deltas; nothing is
+		// read back from the modules, so out-of-core none is reloaded
+		if (KeepCons)
+			Cur = &Cons[ModuleIds[M]];
+		for (Module::iterator i = M->begin(), e = M->end(); i != e; ++i)
+			runOnFunction(&*i);
+		Cur = NULL;
+		bool Changed = Solver.solve();
+		if (++NumPasses >= NumModules)
+			Changed |= applyFallbackArgs();
+		return Changed;
+	}
+
 	bool Changed = true, ret = false;
 	while (Changed) {
 		Changed = false;
@@ -236,14 +732,372 @@ bool CallGraphPass::doModulePass(Module *M) {
 	return ret;
 }
 
+void CallGraphPass::run(ModuleList &modules) {
+	IterativeModulePass::run(modules);
+	// no more unions after the fixpoint
+	Ctx->FuncSets.clearUnions();
+	buildCallGraph(modules);
+	releaseSets();
+}
+
+// Only FuncPtrs, TypeFuncs, the solver and the stand-ins stay resident.
+// The call graph is over the stand-ins and has no call instructions, its
+// sites are added while finalizing each module.
+void CallGraphPass::run(const ModuleFileList &files) {
+	StandIns = true;
+	IterativeModulePass::run(files);
+	Ctx->FuncSets.clearUnions();
+	Ctx->CallGraph.freeze();
+	releaseSets();
+}
+
+// release the sets the fixpoint went through on its way
+void CallGraphPass::releaseSets() {
+	DenseSet<const FuncSetData *> Live;
+	for (FuncPtrMap::iterator i = Ctx->FuncPtrs.begin(),
+	     e = Ctx->FuncPtrs.end(); i != e; ++i)
+		Live.insert(i->second.data());
+	for (CalleeMap::iterator i = Ctx->Callees.begin(),
+	     e = Ctx->Callees.end(); i != e; ++i)
+		Live.insert(i->second.data());
+	for (TypeFuncMap::iterator i = Ctx->TypeFuncs.begin(),
+	     e = Ctx->TypeFuncs.end(); i != e; ++i)
+		Live.insert(i->second.data());
+	// the constraints kept for reload() replay these
+	for (unsigned m = 0; m != Cons.size(); ++m) {
+		for (unsigned k = 0; k != Cons[m].Bases.size(); ++k)
+			Live.insert(Cons[m].Bases[k].second.data());
+		for (unsigned k = 0; k != Cons[m].Calls.size(); ++k)
+			Live.insert(Cons[m].Calls[k].Base.data());
+	}
+	Ctx->FuncSets.sweep(Live);
+}
+
+void CallGraphPass::enableReload() {
+	StandIns = KeepCons = true;
+}
+
+// Whether A and B define the same external functions and take the address
+// of the same functions, which keeps Funcs and TypeFuncs as they are.
+bool CallGraphPass::sameExports(Module *A, Module *B) {
+	typedef std::vector<std::pair<const void *, std::string> > ExportList;
+	ExportList L[2];
+	Module *Ms[2] = { A, B };
+	for (unsigned k = 0; k != 2; ++k) {
+		for (Module::iterator f = Ms[k]->begin(), fe = Ms[k]->end();
+		     f != fe; ++f) {
+			if (f->isIntrinsic())
+				continue;
+			std::string Name = getScopeName(&*f) + (f->empty() ? "" : "+");
+			if (f->hasAddressTaken())
+				L[k].push_back(std::make_pair(
+					typeKey(f->getFunctionType(), true), Name));
+			if (!f->empty() && f->hasExternalLinkage())
+				L[k].push_back(std::make_pair((const void *)NULL, Name));
+		}
+		std::sort(L[k].begin(), L[k].end());
+	}
+	return L[0] == L[1];
+}
+
+// Replace Old by New, the same file loaded again, in what run() left in
+// Ctx. Only keys reached from the constraints of Old or New are solved
+// again, over the constraints every module recorded; all other keys keep
+// their sets, and only call sites that read a key whose set changed are
+// resolved again. The call graph is rebuilt over modules, which lists New
+// instead of Old. Returns false, changing nothing, if New exports other
+// functions than Old, in which case run() has to start over.
+bool CallGraphPass::reload(Module *Old, Module *New, ModuleList &modules) {
+	DenseMap<Module *, unsigned>::iterator It = ModuleIds.find(Old);
+	if (UnifyFuncPtrs || !KeepCons || It == ModuleIds.end()
+	    || !sameExports(Old, New))
+		return false;
+	unsigned Idx = It->second;
+
+	// the constraints of New, recorded but not applied
+	IdKind = New->getContext().getMDKindID(MD_ID);
+	annotateLoadStores(New);
+	for (Module::iterator f = Old->begin(), fe = Old->end(); f != fe; ++f)
+		Extracted.erase(&*f);
+	ModuleCons Next;
+	Cur = &Next;
+	Apply = false;
+	for (Module::global_iterator i = New->global_begin(),
+	     e = New->global_end(); i != e; ++i) {
+		if (i->hasInitializer())
+			processInitializers(New, i->getInitializer(), &*i);
+	}
+	for (Module::iterator f = New->begin(), fe = New->end(); f != fe; ++f)
+		runOnFunction(&*f);
+	Cur = NULL;
+	Apply = true;
+	// from here on, Next holds the constraints of Old
+	std::swap(Cons[Idx], Next);
+
+	// the old solver knows every key either version mentions
+	FuncPtrSolver Prev(std::move(Solver));
+	unsigned N = Prev.size();
+	std::vector<bool> Affected(N, false);
+	std::vector<unsigned> Queue;
+
+	// index the constraints by the nodes that feed them
+	std::vector<std::vector<unsigned> > Succs(N);
+	std::vector<std::vector<const FallbackArg *> > Triggers(N);
+	std::map<unsigned, FuncSet> Inits;
+	StringSet<> InitKeys;
+	for (unsigned m = 0; m != Cons.size(); ++m) {
+		ModuleCons &R = Cons[m];
+		for (unsigned k = 0; k != R.Copies.size(); ++k)
+			Succs[R.Copies[k].first].push_back(R.Copies[k].second);
+		for (unsigned k = 0; k != R.Calls.size(); ++k) {
+			const FallbackArg &FA = R.Calls[k];
+			Triggers[FA.Key].push_back(&FA);
+			for (unsigned s = 0; s != FA.Srcs.size(); ++s)
+				Triggers[FA.Srcs[s]].push_back(&FA);
+		}
+		for (unsigned k = 0; k != R.Inits.size(); ++k) {
+			unsigned I = Prev.lookup(R.Inits[k].first);
+			if (I != ~0U)
+				Inits[I].insert(R.Inits[k].second);
+		}
+	}
+
+	// seed with what Old and New add to
+	ModuleCons *Changed[2] = { &Cons[Idx], &Next };
+	for (unsigned c = 0; c != 2; ++c) {
+		ModuleCons &R = *Changed[c];
+		for (unsigned k = 0; k != R.Bases.size(); ++k)
+			Queue.push_back(R.Bases[k].first);
+		for (unsigned k = 0; k != R.Copies.size(); ++k)
+			Queue.push_back(R.Copies[k].second);
+		for (unsigned k = 0; k != R.Calls.size(); ++k)
+			Queue.push_back(R.Calls[k].Key);
+		for (unsigned k = 0; k != R.Inits.size(); ++k) {
+			InitKeys.insert(R.Inits[k].first);
+			unsigned I = Prev.lookup(R.Inits[k].first);
+			if (I != ~0U)
+				Queue.push_back(I);
+		}
+	}
+
+	FuncPtrMap Saved;
+	for (;;) {
+		// close over copies, and over the arguments of the callees a
+		// call reaches if its pointer or one of its sources is affected
+		while (!Queue.empty()) {
+			unsigned K = Queue.back();
+			Queue.pop_back();
+			if (K >= N || Affected[K])
+				continue;
+			Affected[K] = true;
+			Queue.insert(Queue.end(), Succs[K].begin(), Succs[K].end());
+			for (unsigned t = 0; t != Triggers[K].size(); ++t) {
+				const FallbackArg &FA = *Triggers[K][t];
+				FuncSetRef FS = Prev.getPts(FA.Key);
+				if (FS.empty())
+					FS = getTypeCandidates(FA.TyKey);
+				for (FuncSetRef::iterator i = FS.begin(), e = FS.end();
+				     i != e; ++i)
+					Queue.push_back(Prev.lookup(getArgId(*i, FA.No)));
+			}
+		}
+
+		// the same nodes, without the seeds getNode() takes from FuncPtrs;
+		// the others start at their final sets
+		Saved.swap(Ctx->FuncPtrs);
+		Solver = FuncPtrSolver(Ctx);
+		for (unsigned i = 0; i != N; ++i)
+			Solver.getNode(Prev.getName(i));
+		for (unsigned i = 0; i != N; ++i) {
+			if (!Affected[i])
+				Solver.preset(i, Prev.getPts(i));
+		}
+		for (std::map<unsigned, FuncSet>::iterator i = Inits.begin(),
+		     e = Inits.end(); i != e; ++i) {
+			if (Affected[i->first])
+				Solver.addBase(i->first, Ctx->FuncSets.get(i->second));
+		}
+		for (unsigned m = 0; m != Cons.size(); ++m) {
+			ModuleCons &R = Cons[m];
+			for (unsigned k = 0; k != R.Bases.size(); ++k)
+				Solver.addBase(R.Bases[k].first, R.Bases[k].second);
+			for (unsigned k = 0; k != R.Copies.size(); ++k)
+				Solver.addCopy(R.Copies[k].first, R.Copies[k].second);
+			for (unsigned k = 0; k != R.Calls.size(); ++k) {
+				const FallbackArg &FA = R.Calls[k];
+				Solver.addCall(FA.Key, FA.No, FA.Srcs, FA.Base);
+			}
+		}
+		Solver.solve();
+		DenseSet<const FallbackArg *> Typed;
+		for (unsigned m = 0; m != Cons.size(); ++m) {
+			for (unsigned k = 0; k != Cons[m].Calls.size(); ++k) {
+				if (addTypeFallback(Cons[m].Calls[k]))
+					Typed.insert(&Cons[m].Calls[k]);
+			}
+		}
+		Solver.solve();
+		Saved.swap(Ctx->FuncPtrs);
+
+		// a call may now reach callees whose arguments were taken as
+		// final; start over with those affected as well
+		for (unsigned m = 0; m != Cons.size(); ++m) {
+			for (unsigned k = 0; k != Cons[m].Calls.size(); ++k) {
+				const FallbackArg &FA = Cons[m].Calls[k];
+				if (!Affected[FA.Key])
+					continue;
+				FuncSet FS;
+				mergeFuncSet(FS, Solver.getPts(FA.Key));
+				if (Typed.count(&FA))
+					mergeFuncSet(FS, getTypeCandidates(FA.TyKey));
+				for (FuncSet::iterator i = FS.begin(), e = FS.end();
+				     i != e; ++i) {
+					unsigned A = Prev.lookup(getArgId(*i, FA.No));
+					if (A < N && !Affected[A])
+						Queue.push_back(A);
+				}
+			}
+		}
+		if (Queue.empty())
+			break;
+	}
+
+	// publish the sets that changed
+	StringSet<> ChangedKeys;
+	for (unsigned i = 0; i != Solver.size(); ++i) {
+		if (i < N && !Affected[i])
+			continue;
+		FuncSetRef S = Solver.getPts(i);
+		FuncPtrMap::iterator it = Ctx->FuncPtrs.find(Solver.getName(i));
+		if (it == Ctx->FuncPtrs.end() || it->second != S)
+			ChangedKeys.insert(Solver.getName(i));
+	}
+	Solver.writeBack();
+
+	// keys only global initializers assign to have no node
+	std::map<std::string, FuncSet> InitOnly;
+	for (StringSet<>::iterator i = InitKeys.begin(), e = InitKeys.end();
+	     i != e; ++i) {
+		if (Solver.lookup(i->getKey().str()) == ~0U)
+			InitOnly[i->getKey().str()];
+	}
+	for (unsigned m = 0; m != Cons.size() && !InitOnly.empty(); ++m) {
+		for (unsigned k = 0; k != Cons[m].Inits.size(); ++k) {
+			std::map<std::string, FuncSet>::iterator it =
+				InitOnly.find(Cons[m].Inits[k].first);
+			if (it != InitOnly.end())
+				it->second.insert(Cons[m].Inits[k].second);
+		}
+	}
+	for (std::map<std::string, FuncSet>::iterator i = InitOnly.begin(),
+	     e = InitOnly.end(); i != e; ++i) {
+		FuncSetRef S = Ctx->FuncSets.get(i->second);
+		FuncSetRef &Dst = Ctx->FuncPtrs[i->first];
+		if (Dst != S) {
+			Dst = S;
+			ChangedKeys.insert(i->first);
+		}
+	}
+
+	// callees of New, and of the calls elsewhere that read a changed key
+	for (Module::iterator f = Old->begin(), fe = Old->end(); f != fe; ++f) {
+		for (inst_iterator i = inst_begin(&*f), e = inst_end(&*f); i != e; ++i) {
+			if (CallInst *CI = dyn_cast<CallInst>(&*i)) {
+				Ctx->Callees.erase(CI);
+				SiteKeys.erase(CI);
+			}
+		}
+	}
+	ModuleIds.erase(Old);
+	ModuleIds[New] = Idx;
+	doFinalization(New);
+	for (DenseMap<CallInst *, std::vector<std::string> >::iterator
+	     i = SiteKeys.begin(), e = SiteKeys.end(); i != e; ++i) {
+		CallInst *CI = i->first;
+		Function *F = CI->getParent()->getParent();
+		if (F->getParent() == New)
+			continue;
+		bool Read = false;
+		for (unsigned k = 0; k != i->second.size() && !Read; ++k)
+			Read = ChangedKeys.count(i->second[k]);
+		if (!Read)
+			continue;
+		FuncSet FS;
+		IdKind = CI->getContext().getMDKindID(MD_ID);
+		resolveCall(F, CI, FS);
+		Ctx->Callees[CI] = Ctx->FuncSets.get(FS);
+	}
+
+	Ctx->CallGraph = rsc::CallGraphCSR();
+	buildCallGraph(modules);
+	Ctx->FuncSets.clearUnions();
+	releaseSets();
+	return true;
+}
+
+// freeze Callees into dense-id CSR form for the later traversals, in
+// module order so that ids do not depend on pointer values
+void CallGraphPass::buildCallGraph(ModuleList &modules) {
+	rsc::CallGraphCSR &CG = Ctx->CallGraph;
+
+	// with stand-ins, callees are mapped back to the functions of the
+	// modules: the definition, else the declaration in the caller's
+	// module, else the first one
+	DenseMap<Function *, Function *> Real;
+	for (ModuleList::iterator i = modules.begin(), e = modules.end();
+	     i != e; ++i) {
+		Module *M = i->first;
+		for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+			CG.add_function(&*f);
+			if (!StandIns)
+				continue;
+			Function *C = Ctx->StubModule ?
+				Ctx->StubModule->getFunction(getScopeName(&*f)) : NULL;
+			if (C && (!f->empty() || !Real.count(C)))
+				Real[C] = &*f;
+		}
+	}
+
+	for (ModuleList::iterator i = modules.begin(), e = modules.end();
+	     i != e; ++i) {
+		Module *M = i->first;
+		for (Module::iterator f = M->begin(), fe = M->end(); f != fe; ++f) {
+			for (inst_iterator j = inst_begin(&*f), je = inst_end(&*f);
+			     j != je; ++j) {
+				CallInst *CI = dyn_cast<CallInst>(&*j);
+				if (!CI || isa<IntrinsicInst>(CI))
+					continue;
+				CalleeMap::iterator it = Ctx->Callees.find(CI);
+				if (it == Ctx->Callees.end())
+					continue;
+				rsc::CallGraphCSR::SiteId S = CG.add_site(CI);
+				FuncSetRef v = it->second;
+				for (FuncSetRef::iterator k = v.begin(), ke = v.end();
+				     k != ke; ++k) {
+					Function *T = *k;
+					if (StandIns) {
+						Function *D = T->empty() ?
+							M->getFunction(T->getName()) : NULL;
+						T = D ? D : Real.lookup(T);
+					}
+					if (T)
+						CG.add_edge(S, T);
+				}
+			}
+		}
+	}
+
+	CG.freeze();
+}
+
 // debug
 void CallGraphPass::dumpFuncPtrs() {
 	raw_ostream &OS = dbgs();
 	for (FuncPtrMap::iterator i = Ctx->FuncPtrs.begin(), 
 		 e = Ctx->FuncPtrs.end(); i != e; ++i) {
 		OS << i->first << "\n";
-		FuncSet &v = i->second;
-		for (FuncSet::iterator j = v.begin(), ej = v.end();
+		FuncSetRef v = i->second;
+		for (FuncSetRef::iterator j = v.begin(), ej = v.end();
 			 j != ej; ++j) {
 			OS << "  " << ((*j)->hasInternalLinkage() ? "f" : "F")
 				<< " " << (*j)->getName() << "\n";
@@ -257,12 +1111,12 @@ void CallGraphPass::dumpCallees() {
 		 e = Ctx->Callees.end(); i != e; ++i) {
 		 
 		CallInst *CI = i->first;
-		FuncSet &v = i->second;
+		FuncSetRef v = i->second;
 		if (CI->isInlineAsm() || CI->getCalledFunction() || v.empty())
 		 	continue;
 
-		CI->dump();
-		for (FuncSet::iterator j = v.begin(), ej = v.end();
+		OS << *CI << "\n";
+		for (FuncSetRef::iterator j = v.begin(), ej = v.end();
 			 j != ej; ++j) {
 			OS << "         " << ((*j)->hasInternalLinkage() ? "f" : "F")
 				<< " " << (*j)->getName() << "\n";
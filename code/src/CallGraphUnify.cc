@@ -0,0 +1,187 @@
+// Unification-based function pointer resolution (-fp-unify).
+//
+// Instead of propagating FuncSets along each flow until the fixpoint,
+// every flow between two FuncPtrs keys merges their equivalence classes,
+// and each class keeps one FuncSet for all of its keys. This trades
+// precision (a key sees every function stored into any key it was ever
+// unified with) for near-linear running time.
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Constants.h>
+
+#include "rsc_CallGraph.h"
+#include "rsc_utils.h"
+
+using namespace llvm;
+
+unsigned CallGraphPass::getClass(const std::string &Id) {
+	std::pair<std::map<std::string, unsigned>::iterator, bool> R =
+		KeyIds.insert(std::make_pair(Id, (unsigned)Parent.size()));
+	if (R.second) {
+		Parent.push_back(R.first->second);
+		Rank.push_back(0);
+		// seed with assignments from global initializers
+		FuncPtrMap::iterator i = Ctx->FuncPtrs.find(Id);
+		ClassFuncs.push_back(i != Ctx->FuncPtrs.end() ? i->second : FuncSetRef());
+	}
+	return findClass(R.first->second);
+}
+
+unsigned CallGraphPass::findClass(unsigned K) {
+	// path halving
+	while (Parent[K] != K) {
+		Parent[K] = Parent[Parent[K]];
+		K = Parent[K];
+	}
+	return K;
+}
+
+bool CallGraphPass::unify(unsigned A, unsigned B) {
+	A = findClass(A);
+	B = findClass(B);
+	if (A == B)
+		return false;
+
+	// union by rank
+	if (Rank[A] < Rank[B])
+		std::swap(A, B);
+	Parent[B] = A;
+	if (Rank[A] == Rank[B])
+		++Rank[A];
+
+	ClassFuncs[A] = Ctx->FuncSets.unite(ClassFuncs[A], ClassFuncs[B]);
+	ClassFuncs[B] = FuncSetRef();
+	changedKey(A);
+	changedKey(B);
+	return true;
+}
+
+// Same traversal as findFunctions, but report the keys a value flows from
+// instead of reading their sets.
+void CallGraphPass::collectSources(Value *V, FuncSet &S,
+                                   std::vector<std::string> &Keys,
+                                   SmallPtrSet<Value *, 4> &Visited) {
+	if (!Visited.insert(V).second)
+		return;
+
+	if (Function *F = dyn_cast<Function>(V)) {
+		FuncMap::iterator it = Ctx->Funcs.find(F->getName());
+		if (F->empty() && it != Ctx->Funcs.end())
+			S.insert(it->second);
+		else
+			S.insert(canon(F));
+	} else if (BitCastInst *B = dyn_cast<BitCastInst>(V)) {
+		collectSources(B->getOperand(0), S, Keys, Visited);
+	} else if (ConstantExpr *C = dyn_cast<ConstantExpr>(V)) {
+		if (C->isCast())
+			collectSources(C->getOperand(0), S, Keys, Visited);
+	} else if (PHINode *P = dyn_cast<PHINode>(V)) {
+		for (unsigned i = 0; i != P->getNumIncomingValues(); ++i)
+			collectSources(P->getIncomingValue(i), S, Keys, Visited);
+	} else if (SelectInst *SI = dyn_cast<SelectInst>(V)) {
+		collectSources(SI->getTrueValue(), S, Keys, Visited);
+		collectSources(SI->getFalseValue(), S, Keys, Visited);
+	} else if (Argument *A = dyn_cast<Argument>(V)) {
+		Keys.push_back(getArgId(A));
+	} else if (CallInst *CI = dyn_cast<CallInst>(V)) {
+		if (Function *CF = CI->getCalledFunction())
+			Keys.push_back(getRetId(CF));
+		else
+			mergeFuncSet(S, getTypeCandidates(CI->getType()));
+	} else if (LoadInst *L = dyn_cast<LoadInst>(V)) {
+		StringRef Id = getLoadStoreId(L, IdKind);
+		if (!Id.empty())
+			Keys.push_back(Id.str());
+		else
+			mergeFuncSet(S, getTypeCandidates(L->getType()));
+	} else if (IntToPtrInst *IP = dyn_cast<IntToPtrInst>(V)) {
+		mergeFuncSet(S, getTypeCandidates(IP->getType()));
+	}
+}
+
+// Id = V: merge the classes of all keys V flows from into the class of Id
+bool CallGraphPass::unifyFlow(const std::string &Id, Value *V) {
+	FuncSet S;
+	std::vector<std::string> Keys;
+	SmallPtrSet<Value *, 4> Visited;
+	collectSources(V, S, Keys, Visited);
+
+	bool Changed = false;
+	unsigned C = getClass(Id);
+	for (unsigned i = 0; i != Keys.size(); ++i)
+		Changed |= unify(C, getClass(Keys[i]));
+
+	C = findClass(C);
+	if (mergeFuncSet(ClassFuncs[C], Ctx->FuncSets.get(S))) {
+		changedKey(C);
+		Changed = true;
+	}
+	return Changed;
+}
+
+void CallGraphPass::findClassFunctions(Value *V, FuncSet &S) {
+	std::vector<std::string> Keys;
+	SmallPtrSet<Value *, 4> Visited;
+	collectSources(V, S, Keys, Visited);
+	// keys with an empty class are called as candidates of V's type; the
+	// classes are all a module reads, see IterativeModulePass::isStale()
+	for (unsigned i = 0; i != Keys.size(); ++i) {
+		unsigned K = getClass(Keys[i]);
+		readKey(K);
+		FuncSetRef C = ClassFuncs[K];
+		mergeFuncSet(S, C.empty() ? getTypeCandidates(V->getType()) : C);
+	}
+}
+
+bool CallGraphPass::unifyOnFunction(Function *F) {
+	bool Changed = false;
+
+	for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
+		Instruction *I = &*i;
+		if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+			Value *V = SI->getValueOperand();
+			if (isFunctionPointer(V->getType())) {
+				StringRef Id = getLoadStoreId(SI, IdKind);
+				if (!Id.empty())
+					Changed |= unifyFlow(Id.str(), V);
+			}
+		} else if (ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
+			if (isFunctionPointer(F->getReturnType()))
+				Changed |= unifyFlow(getRetId(F), RI->getReturnValue());
+		} else if (CallInst *CI = dyn_cast<CallInst>(I)) {
+			if (CI->isInlineAsm() || (CI->getCalledFunction()
+					&& CI->getCalledFunction()->isIntrinsic()))
+				continue;
+
+			// outside the refined set, by type as in doFinalization
+			Value *CV = CI->getCalledValue();
+			FuncSet FS;
+			if (!CI->getCalledFunction() && !isRefined(F))
+				mergeFuncSet(FS, getTypeCandidates(CV->getType()));
+			else
+				findClassFunctions(CV, FS);
+			if (FS.empty())
+				continue;
+
+			for (unsigned no = 0; no != CI->getNumArgOperands(); ++no) {
+				Value *V = CI->getArgOperand(no);
+				if (!isFunctionPointer(V->getType()))
+					continue;
+				for (FuncSet::iterator k = FS.begin(), ke = FS.end();
+				        k != ke; ++k)
+					Changed |= unifyFlow(getArgId(*k, no), V);
+			}
+		}
+	}
+	return Changed;
+}
+
+void CallGraphPass::materializeClasses() {
+	for (std::map<std::string, unsigned>::iterator i = KeyIds.begin(),
+	     e = KeyIds.end(); i != e; ++i)
+		Ctx->FuncPtrs[i->first] = ClassFuncs[findClass(i->second)];
+}
@@ -0,0 +1,241 @@
+#include <llvm/IR/Function.h>
+
+#include "rsc_FuncPtrSolver.h"
+#include "rsc_utils.h"
+
+using namespace llvm;
+
+unsigned FuncPtrSolver::find(unsigned N) {
+	while (Rep[N] != N) {
+		Rep[N] = Rep[Rep[N]];
+		N = Rep[N];
+	}
+	return N;
+}
+
+void FuncPtrSolver::push(unsigned N) {
+	if (Queued[N])
+		return;
+	Queued[N] = true;
+	Worklist.push_back(N);
+}
+
+unsigned FuncPtrSolver::getNode(const std::string &Id) {
+	std::pair<std::map<std::string, unsigned>::iterator, bool> R =
+		Ids.insert(std::make_pair(Id, (unsigned)Names.size()));
+	if (!R.second)
+		return R.first->second;
+
+	unsigned N = R.first->second;
+	Names.push_back(Id);
+	Rep.push_back(N);
+	Pts.push_back(FuncSetRef());
+	Delta.push_back(FuncSetRef());
+	Succs.push_back(std::vector<unsigned>());
+	Calls.push_back(std::vector<CallCons>());
+	Queued.push_back(false);
+
+	// seed with assignments from global initializers
+	FuncPtrMap::iterator i = Ctx->FuncPtrs.find(Id);
+	if (i != Ctx->FuncPtrs.end())
+		propagate(N, i->second);
+	return N;
+}
+
+unsigned FuncPtrSolver::lookup(const std::string &Id) const {
+	std::map<std::string, unsigned>::const_iterator i = Ids.find(Id);
+	return i == Ids.end() ? ~0U : i->second;
+}
+
+void FuncPtrSolver::preset(unsigned N, FuncSetRef S) {
+	N = find(N);
+	Pts[N] = S;
+	if (Settled.size() < Names.size())
+		Settled.resize(Names.size(), false);
+	Settled[N] = true;
+}
+
+// Pts[Dst] += S, remembering the new part as delta
+void FuncPtrSolver::propagate(unsigned Dst, FuncSetRef S) {
+	Dst = find(Dst);
+	FuncSetRef New = Ctx->FuncSets.subtract(S, Pts[Dst]);
+	if (New.empty())
+		return;
+	Pts[Dst] = Ctx->FuncSets.unite(Pts[Dst], New);
+	Delta[Dst] = Ctx->FuncSets.unite(Delta[Dst], New);
+	Changed = true;
+	push(Dst);
+}
+
+void FuncPtrSolver::addBase(unsigned Dst, FuncSetRef S) {
+	Dst = find(Dst);
+	if (settled(Dst))
+		return;
+	propagate(Dst, S);
+}
+
+void FuncPtrSolver::addCopy(unsigned Src, unsigned Dst) {
+	Src = find(Src);
+	Dst = find(Dst);
+	if (Src == Dst || !Edges.insert(std::make_pair(Src, Dst)).second)
+		return;
+	Succs[Src].push_back(Dst);
+	// a new edge has to carry everything seen so far, not just the delta
+	if (settled(Dst) && settled(Src))
+		return;
+	propagate(Dst, Pts[Src]);
+}
+
+void FuncPtrSolver::addCall(unsigned Callee, unsigned No,
+			    const std::vector<unsigned> &Srcs, FuncSetRef Base) {
+	Callee = find(Callee);
+	CallCons C;
+	C.No = No;
+	C.Srcs = Srcs;
+	C.Base = Base;
+	Calls[Callee].push_back(C);
+
+	// apply to the callees known so far
+	FuncSetRef Known = Pts[Callee];
+	for (FuncSetRef::iterator i = Known.begin(), e = Known.end(); i != e; ++i) {
+		unsigned Dst = getNode(getArgId(*i, No));
+		for (unsigned k = 0; k != Srcs.size(); ++k)
+			addCopy(Srcs[k], Dst);
+		addBase(Dst, Base);
+	}
+}
+
+// merge B into A
+void FuncPtrSolver::collapse(unsigned A, unsigned B) {
+	A = find(A);
+	B = find(B);
+	if (A == B)
+		return;
+
+	Rep[B] = A;
+	Pts[A] = Ctx->FuncSets.unite(Pts[A], Pts[B]);
+	// successors of either side may miss targets of the other, so the
+	// merged node re-propagates its whole set once
+	Delta[A] = Pts[A];
+	Succs[A].insert(Succs[A].end(), Succs[B].begin(), Succs[B].end());
+	Calls[A].insert(Calls[A].end(), Calls[B].begin(), Calls[B].end());
+	Pts[B] = Delta[B] = FuncSetRef();
+	std::vector<unsigned>().swap(Succs[B]);
+	std::vector<CallCons>().swap(Calls[B]);
+	++NumCollapsed;
+	push(A);
+}
+
+// Tarjan from Root over representatives, collapsing every cycle found
+void FuncPtrSolver::collapseCycles(unsigned Root) {
+	const unsigned UNVISITED = ~0U;
+	std::map<unsigned, unsigned> DFSNum, Lowest;
+	std::vector<unsigned> Stack;
+	llvm::DenseSet<unsigned> OnStack;
+	std::vector<std::pair<unsigned, unsigned> > Frames;
+	std::vector<std::vector<unsigned> > Cycles;
+	unsigned Index = 0;
+
+	Root = find(Root);
+	Frames.push_back(std::make_pair(Root, 0));
+	DFSNum[Root] = Lowest[Root] = Index++;
+	Stack.push_back(Root);
+	OnStack.insert(Root);
+
+	while (!Frames.empty()) {
+		unsigned V = Frames.back().first;
+		unsigned &Next = Frames.back().second;
+
+		if (Next < Succs[V].size()) {
+			unsigned W = find(Succs[V][Next++]);
+			std::map<unsigned, unsigned>::iterator it = DFSNum.find(W);
+			if (it == DFSNum.end()) {
+				DFSNum[W] = Lowest[W] = Index++;
+				Stack.push_back(W);
+				OnStack.insert(W);
+				Frames.push_back(std::make_pair(W, 0));
+			} else if (OnStack.count(W)) {
+				Lowest[V] = std::min(Lowest[V], it->second);
+			}
+			continue;
+		}
+
+		if (Lowest[V] == DFSNum[V]) {
+			std::vector<unsigned> SCC;
+			unsigned W = UNVISITED;
+			while (W != V) {
+				W = Stack.back();
+				Stack.pop_back();
+				OnStack.erase(W);
+				SCC.push_back(W);
+			}
+			if (SCC.size() > 1)
+				Cycles.push_back(SCC);
+		}
+
+		Frames.pop_back();
+		if (!Frames.empty()) {
+			unsigned U = Frames.back().first;
+			Lowest[U] = std::min(Lowest[U], Lowest[V]);
+		}
+	}
+
+	for (unsigned i = 0; i != Cycles.size(); ++i)
+		for (unsigned k = 1; k != Cycles[i].size(); ++k)
+			collapse(Cycles[i][0], Cycles[i][k]);
+}
+
+bool FuncPtrSolver::solve() {
+	// preset sets only hold until they can grow
+	std::vector<bool>().swap(Settled);
+
+	while (!Worklist.empty()) {
+		unsigned N = Worklist.back();
+		Worklist.pop_back();
+		Queued[N] = false;
+		if (find(N) != N)
+			continue;
+
+		FuncSetRef D = Delta[N];
+		if (D.empty())
+			continue;
+		Delta[N] = FuncSetRef();
+
+		// indirect calls through N gained callees
+		for (unsigned c = 0; c != Calls[N].size(); ++c) {
+			CallCons C = Calls[N][c];
+			for (FuncSetRef::iterator i = D.begin(), e = D.end(); i != e; ++i) {
+				unsigned Dst = getNode(getArgId(*i, C.No));
+				for (unsigned k = 0; k != C.Srcs.size(); ++k)
+					addCopy(C.Srcs[k], Dst);
+				addBase(Dst, C.Base);
+			}
+		}
+
+		for (unsigned s = 0; s != Succs[N].size(); ++s) {
+			unsigned M = find(Succs[N][s]);
+			if (M == N)
+				continue;
+			FuncSetRef New = Ctx->FuncSets.subtract(D, Pts[M]);
+			if (!New.empty()) {
+				propagate(M, New);
+			} else if (Pts[M] == Pts[N]
+				   && Checked.insert(std::make_pair(N, M)).second) {
+				// nothing new and equal sets: probably a cycle
+				collapseCycles(M);
+				if (find(N) != N)
+					break;
+			}
+		}
+	}
+
+	// also reports growth from constraints added since the last solve
+	bool Ret = Changed;
+	Changed = false;
+	return Ret;
+}
+
+void FuncPtrSolver::writeBack() {
+	for (unsigned i = 0; i != Names.size(); ++i)
+		Ctx->FuncPtrs[Names[i]] = Pts[find(i)];
+}
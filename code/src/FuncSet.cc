@@ -0,0 +1,103 @@
+#include "rsc_FuncSet.h"
+
+using namespace llvm;
+
+const FuncSetData FuncSetData::Empty;
+
+FuncSetPool::~FuncSetPool() {
+	for (DataSet::iterator i = Sets.begin(),
+	     e = Sets.end(); i != e; ++i)
+		delete *i;
+}
+
+// Elems must be sorted and unique; it is consumed.
+FuncSetRef FuncSetPool::intern(std::vector<Function *> &Elems) {
+	if (Elems.empty())
+		return FuncSetRef();
+
+	FuncSetData *S = new FuncSetData(Elems);
+	std::pair<DataSet::iterator, bool> R =
+		Sets.insert(S);
+	if (!R.second)
+		delete S;
+	return FuncSetRef(*R.first);
+}
+
+FuncSetRef FuncSetPool::get(const SmallPtrSet<Function *, 8> &S) {
+	std::vector<Function *> Elems(S.begin(), S.end());
+	std::sort(Elems.begin(), Elems.end());
+	return intern(Elems);
+}
+
+FuncSetRef FuncSetPool::unite(FuncSetRef A, FuncSetRef B) {
+	if (A == B || B.empty())
+		return A;
+	if (A.empty())
+		return B;
+
+	DataPair Key = A.data() < B.data() ? DataPair(A.data(), B.data())
+					   : DataPair(B.data(), A.data());
+	DenseMap<DataPair, const FuncSetData *>::iterator it = Unions.find(Key);
+	if (it != Unions.end())
+		return FuncSetRef(it->second);
+
+	FuncSetRef R;
+	if (std::includes(A.begin(), A.end(), B.begin(), B.end()))
+		R = A;
+	else if (std::includes(B.begin(), B.end(), A.begin(), A.end()))
+		R = B;
+	else {
+		std::vector<Function *> Elems;
+		Elems.reserve(A.size() + B.size());
+		std::set_union(A.begin(), A.end(), B.begin(), B.end(),
+			       std::back_inserter(Elems));
+		R = intern(Elems);
+	}
+
+	// the memo only saves work, start over rather than grow without bound
+	if (Unions.size() >= MaxUnions)
+		Unions.clear();
+	Unions[Key] = R.data();
+	return R;
+}
+
+void FuncSetPool::clearUnions() {
+	DenseMap<DataPair, const FuncSetData *>().swap(Unions);
+}
+
+void FuncSetPool::sweep(const DenseSet<const FuncSetData *> &Live) {
+	clearUnions();
+	for (DataSet::iterator i = Sets.begin(), e = Sets.end(); i != e; ) {
+		if (Live.count(*i)) {
+			++i;
+			continue;
+		}
+		FuncSetData *S = *i;
+		i = Sets.erase(i);
+		delete S;
+	}
+}
+
+FuncSetRef FuncSetPool::subtract(FuncSetRef A, FuncSetRef B) {
+	if (A.empty() || B.empty())
+		return A;
+	if (A == B)
+		return FuncSetRef();
+
+	std::vector<Function *> Elems;
+	std::set_difference(A.begin(), A.end(), B.begin(), B.end(),
+			    std::back_inserter(Elems));
+	if (Elems.size() == A.size())
+		return A;
+	return intern(Elems);
+}
+
+// interned sets plus the memo of unions
+rsc::mem::Usage FuncSetPool::memory() const {
+	rsc::mem::Usage U(Sets.size(), Sets.bucket_count() * sizeof(void *));
+	for (DataSet::const_iterator i = Sets.begin(), e = Sets.end(); i != e; ++i)
+		U.bytes += sizeof(FuncSetData) + 2 * sizeof(void *)
+			+ (*i)->Elems.capacity() * sizeof(Function *);
+	U.bytes += rsc::mem::of(Unions).bytes;
+	return U;
+}
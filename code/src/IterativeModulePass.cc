@@ -0,0 +1,168 @@
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/SourceMgr.h>
+#include <algorithm>
+#include <memory>
+
+#include "rsc_Global.h"
+#include "Trace.h"
+
+using namespace llvm;
+
+void IterativeModulePass::run(ModuleList &modules) {
+	ModuleList::iterator i, e;
+
+	dbgs() << "[" << ID << "] Initializing " << modules.size() << " modules ";
+	{
+		rsc::trace::Span S(std::string(ID) + ".init");
+		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+			rsc::trace::Span M(i->second, rsc::trace::MODULE);
+			doInitialization(i->first);
+			dbgs() << ".";
+		}
+	}
+	dbgs() << "\n";
+	Ctx->logMemory(std::string(ID) + ".init");
+
+	unsigned iter = 0, changed = 1;
+	while (changed) {
+		++iter;
+		changed = 0;
+		rsc::trace::Span S(std::string(ID) + ".round." + utostr(iter));
+		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+			dbgs() << "[" << ID << " / " << iter << "] ";
+			dbgs() << "[" << i->second << "]\n";
+
+			rsc::trace::Span M(i->second, rsc::trace::MODULE);
+			bool ret = doModulePass(i->first);
+			if (ret) {
+				++changed;
+				dbgs() << "\t [CHANGED]\n";
+			} else
+				dbgs() << "\n";
+		}
+		dbgs() << "[" << ID << "] Updated in " << changed << " modules.\n";
+		Ctx->logMemory(std::string(ID) + ".round." + utostr(iter));
+	}
+
+	dbgs() << "[" << ID << "] Finalizing ";
+	{
+		rsc::trace::Span S(std::string(ID) + ".final");
+		for (i = modules.begin(), e = modules.end(); i != e; ++i) {
+			rsc::trace::Span M(i->second, rsc::trace::MODULE);
+			doFinalization(i->first);
+			dbgs() << ".";
+		}
+	}
+	dbgs() << "\n";
+	Ctx->logMemory(std::string(ID) + ".final");
+}
+
+void IterativeModulePass::readKey(unsigned Key) {
+	if (OutOfCore && Current < Inputs.size())
+		Inputs[Current].push_back(Key);
+}
+
+void IterativeModulePass::changedKey(unsigned Key) {
+	if (!OutOfCore)
+		return;
+	if (Key >= KeyStamp.size())
+		KeyStamp.resize(Key + 1, 0);
+	KeyStamp[Key] = ++Clock;
+}
+
+bool IterativeModulePass::isStale(unsigned Idx) const {
+	const std::vector<unsigned> &In = Inputs[Idx];
+	for (unsigned i = 0; i != In.size(); ++i)
+		if (In[i] < KeyStamp.size() && KeyStamp[In[i]] > LastRun[Idx])
+			return true;
+	return false;
+}
+
+// Every step parses its module into a context of its own, which is
+// destroyed with the module at the end of the step.
+void IterativeModulePass::run(const ModuleFileList &files) {
+	unsigned n = files.size();
+	OutOfCore = true;
+	LastRun.assign(n, 0);
+	Inputs.assign(n, std::vector<unsigned>());
+
+	dbgs() << "[" << ID << "] Initializing " << n << " modules out-of-core ";
+	{
+		rsc::trace::Span S(std::string(ID) + ".init");
+		for (unsigned i = 0; i != n; ++i) {
+			rsc::trace::Span T(files[i], rsc::trace::MODULE);
+			LLVMContext C;
+			SMDiagnostic Err;
+			std::unique_ptr<Module> M = parseIRFile(files[i], Err, C);
+			if (!M) {
+				Err.print(ID, errs());
+				continue;
+			}
+			doInitialization(M.get());
+			dbgs() << ".";
+		}
+	}
+	dbgs() << "\n";
+	Ctx->logMemory(std::string(ID) + ".init");
+
+	// every module runs in the first round, then only the stale ones
+	unsigned iter = 0, loaded = 1;
+	while (loaded) {
+		++iter;
+		loaded = 0;
+		unsigned changed = 0;
+		rsc::trace::Span S(std::string(ID) + ".round." + utostr(iter));
+		for (unsigned i = 0; i != n; ++i) {
+			if (iter > 1 && !isStale(i))
+				continue;
+			rsc::trace::Span T(files[i], rsc::trace::MODULE);
+			LLVMContext C;
+			SMDiagnostic Err;
+			std::unique_ptr<Module> M = parseIRFile(files[i], Err, C);
+			if (!M)
+				continue;
+			++loaded;
+			dbgs() << "[" << ID << " / " << iter << "] ";
+			dbgs() << "[" << files[i] << "]\n";
+
+			Current = i;
+			LastRun[i] = Clock;
+			Inputs[i].clear();
+			bool ret = doModulePass(M.get());
+			Current = ~0U;
+
+			std::vector<unsigned> &In = Inputs[i];
+			std::sort(In.begin(), In.end());
+			In.erase(std::unique(In.begin(), In.end()), In.end());
+
+			if (ret) {
+				++changed;
+				dbgs() << "\t [CHANGED]\n";
+			} else
+				dbgs() << "\n";
+		}
+		dbgs() << "[" << ID << "] Reloaded " << loaded
+		       << " modules, updated in " << changed << " modules.\n";
+		Ctx->logMemory(std::string(ID) + ".round." + utostr(iter));
+	}
+
+	dbgs() << "[" << ID << "] Finalizing ";
+	{
+		rsc::trace::Span S(std::string(ID) + ".final");
+		for (unsigned i = 0; i != n; ++i) {
+			rsc::trace::Span T(files[i], rsc::trace::MODULE);
+			LLVMContext C;
+			SMDiagnostic Err;
+			std::unique_ptr<Module> M = parseIRFile(files[i], Err, C);
+			if (!M)
+				continue;
+			doFinalization(M.get());
+			dbgs() << ".";
+		}
+	}
+	dbgs() << "\n";
+	Ctx->logMemory(std::string(ID) + ".final");
+}
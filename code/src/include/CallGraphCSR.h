@@ -0,0 +1,110 @@
+//===---- CallGraphCSR.h - Frozen call graph in CSR form --------*- C++ -*-===//
+
+#ifndef CALLGRAPH_CSR_H
+#define CALLGRAPH_CSR_H
+
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+#include "MemLog.h"
+
+namespace rsc {
+
+/*
+ * An immutable call graph with dense ids. Functions and call sites are
+ * numbered from 0, and every adjacency (site -> callees, function ->
+ * callees, function -> callers, function -> sites) is stored as an offset
+ * array plus a contiguous target array, so traversals touch only a few
+ * flat vectors instead of chasing map nodes.
+ *
+ * The graph is filled with add_function()/add_site()/add_edge() and then
+ * frozen with freeze(); afterwards it can only be queried.
+ */
+class CallGraphCSR {
+public:
+	typedef unsigned FuncId;
+	typedef unsigned SiteId;
+
+	static const unsigned NONE = ~0U;
+
+	class Range {
+		const unsigned *b, *e;
+	public:
+		Range(const unsigned *b, const unsigned *e) : b(b), e(e) {}
+		const unsigned *begin() const { return b; }
+		const unsigned *end() const { return e; }
+		unsigned size() const { return e - b; }
+		bool empty() const { return b == e; }
+	};
+
+private:
+	bool frozen;
+
+	std::vector<llvm::Function*> funcs;
+	llvm::DenseMap<const llvm::Function*, FuncId> func_ids;
+	std::vector<llvm::CallInst*> sites;
+	llvm::DenseMap<const llvm::CallInst*, SiteId> site_ids;
+	std::vector<FuncId> site_caller;
+
+	std::vector<std::pair<SiteId, FuncId>> pending;    // edges before freeze()
+
+	std::vector<unsigned> site_off, site_tgt;          // site -> callees
+	std::vector<unsigned> callee_off, callee_tgt;      // function -> callees
+	std::vector<unsigned> caller_off, caller_tgt;      // function -> callers
+	std::vector<unsigned> fsite_off, fsite_tgt;        // function -> sites
+
+	static Range range(const std::vector<unsigned> &off,
+			   const std::vector<unsigned> &tgt, unsigned i) {
+		return Range(tgt.data() + off[i], tgt.data() + off[i + 1]);
+	}
+
+public:
+	CallGraphCSR() : frozen(false) {}
+
+	FuncId add_function(llvm::Function *F);
+	SiteId add_site(llvm::CallInst *CI);
+	// a site without an instruction, for graphs that outlive their IR;
+	// site() is NULL for it
+	SiteId add_site(llvm::Function *Caller);
+	void add_edge(SiteId site, llvm::Function *callee);
+	void freeze();
+
+	// Convenience builder over LLVM's call graph (direct calls only)
+	void build(llvm::CallGraph &CG);
+
+	bool is_frozen() const { return frozen; }
+
+	unsigned nr_functions() const { return funcs.size(); }
+	unsigned nr_sites() const { return sites.size(); }
+	unsigned nr_edges() const { return callee_tgt.size(); }
+
+	FuncId id(const llvm::Function *F) const {
+		auto it = func_ids.find(F);
+		return it == func_ids.end() ? NONE : it->second;
+	}
+	SiteId id(const llvm::CallInst *CI) const {
+		auto it = site_ids.find(CI);
+		return it == site_ids.end() ? NONE : it->second;
+	}
+
+	llvm::Function *function(FuncId f) const { return funcs[f]; }
+	llvm::CallInst *site(SiteId s) const { return sites[s]; }
+	FuncId caller(SiteId s) const { return site_caller[s]; }
+
+	Range targets(SiteId s) const { assert(frozen); return range(site_off, site_tgt, s); }
+	Range callees(FuncId f) const { assert(frozen); return range(callee_off, callee_tgt, f); }
+	Range callers(FuncId f) const { assert(frozen); return range(caller_off, caller_tgt, f); }
+	Range sites_in(FuncId f) const { assert(frozen); return range(fsite_off, fsite_tgt, f); }
+
+	void memory(mem::Snapshot &S) const;
+};
+
+};
+
+#endif  /* CALLGRAPH_CSR_H */
@@ -20,6 +20,8 @@
 #include <z3.h>
 #include <z3++.h>
 
+#include "MemLog.h"
+
 namespace rsc {
 
 class Expr;
@@ -80,6 +82,20 @@ public:
 	void copy_path(int old_id, int new_id) { pathtree[new_id] = old_id; }
 
 	void dump_var_bindings();
+
+	// Sizes of the pools only, operands and formulas are not followed
+	void memory(mem::Snapshot &S) const {
+		S.add("context.operands", mem::of(operands));
+		mem::Usage O = mem::of(constants);
+		O += mem::of(variables);
+		O += mem::of(name_to_variables);
+		O += mem::of(signatures);
+		S.add("context.operand_maps", O);
+		mem::Usage A = mem::of(value_to_atoms);
+		A += mem::of(name_to_atoms);
+		S.add("context.atoms", A);
+		S.add("context.paths", mem::of(pathtree));
+	}
 };
 
 class Expr {
@@ -93,14 +109,28 @@ public:
 	Expr(Context &c) : c(c) {}
 	virtual ~Expr() {}
 
+	// z3::expr overloads ! and &&, so test the AST pointer itself
+	static bool is_null(const z3::expr &e) { return (Z3_ast)e == NULL; }
+
 	virtual z3::expr z3_expr() = 0;
 
 	virtual void serialize(std::ofstream &fout) = 0;
 };
 
+/*
+ * Both operands and formulas keep the Z3 AST they were last converted to,
+ * together with what it was built from: the values of their own fields and
+ * the ASTs of their children. z3_expr() returns it as long as these are
+ * unchanged, so converting a formula again costs a walk of its tree but
+ * no calls into Z3. As Z3 shares structurally equal ASTs, a child rebuilt
+ * into the same term does not invalidate its parents either.
+ */
 class Operand : public Expr {
+protected:
+	z3::expr ast;                           // null until first converted
+
 public:
-	Operand(Context &c) : Expr(c) {}
+	Operand(Context &c) : Expr(c), ast(c.z3) {}
 	virtual ~Operand() {}
 
 	virtual bool is_constant() { return false; }
@@ -123,8 +153,14 @@ public:
 
 	virtual bool is_constant() { return true; }
 
+	long long ast_i;
+
 	virtual z3::expr z3_expr() {
-		return c.z3.int_val(i);
+		if (is_null(ast) || ast_i != i) {
+			ast = c.z3.int_val((int64_t)i);
+			ast_i = i;
+		}
+		return ast;
 	}
 
 	virtual Operand *deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -150,8 +186,14 @@ public:
 
 	virtual bool is_variable() { return true; }
 
+	std::string ast_name;
+
 	virtual z3::expr z3_expr() {
-		return c.z3.int_const(name.c_str());
+		if (is_null(ast) || ast_name != name) {
+			ast = c.z3.int_const(name.c_str());
+			ast_name = name;
+		}
+		return ast;
 	}
 
 	virtual Operand *deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -177,8 +219,14 @@ public:
 
 	virtual bool is_signature() { return true; }
 
+	std::string ast_sig;
+
 	virtual z3::expr z3_expr() {
-		return c.z3.int_const(sig.c_str());
+		if (is_null(ast) || ast_sig != sig) {
+			ast = c.z3.int_const(sig.c_str());
+			ast_sig = sig;
+		}
+		return ast;
 	}
 
 	virtual Operand *deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -208,10 +256,23 @@ protected:
 		T_Negation,
 	};
 
-	__Formula(Context &c) : Expr(c) {}
+	z3::expr ast;                           // null until first converted
+	Z3_ast args[2];                         // children's ASTs when converted
+
+	__Formula(Context &c) : Expr(c), ast(c.z3) { args[0] = args[1] = NULL; }
 
 	virtual Type get_type() { return T_Base; };
 
+	bool cached(Z3_ast p, Z3_ast q = NULL) const {
+		return !is_null(ast) && args[0] == p && args[1] == q;
+	}
+	const z3::expr &remember(const z3::expr &e, Z3_ast p = NULL, Z3_ast q = NULL) {
+		ast = e;
+		args[0] = p;
+		args[1] = q;
+		return ast;
+	}
+
 public:
 	virtual ~__Formula() {}
 
@@ -246,7 +307,7 @@ public:
 	}
 
 	virtual z3::expr z3_expr() {
-		return c.z3.bool_val(true);
+		return is_null(ast) ? remember(c.z3.bool_val(true)) : ast;
 	}
 
 	virtual Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -274,7 +335,7 @@ public:
 	}
 
 	virtual z3::expr z3_expr() {
-		return c.z3.bool_val(false);
+		return is_null(ast) ? remember(c.z3.bool_val(false)) : ast;
 	}
 
 	virtual Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -325,22 +386,38 @@ public:
 
 	llvm::StringRef getName() { return llvm::StringRef(name); }
 
+	Operator ast_op;
+	std::string ast_name;
+
 	virtual z3::expr z3_expr() {
+		if (op == OP_NULL) {
+			if (!cached(NULL) || ast_op != op || ast_name != name) {
+				remember(c.z3.bool_const(name.c_str()));
+				ast_op = op;
+				ast_name = name;
+			}
+			return ast;
+		}
+
+		z3::expr l = lhs->z3_expr(), r = rhs->z3_expr();
+		if (cached(l, r) && ast_op == op)
+			return ast;
+		ast_op = op;
 		switch (op) {
 		case OP_EQ:
-			return (lhs->z3_expr() == rhs->z3_expr());
+			return remember(l == r, l, r);
 		case OP_NE:
-			return (lhs->z3_expr() != rhs->z3_expr());
+			return remember(l != r, l, r);
 		case OP_LT:
-			return (lhs->z3_expr() < rhs->z3_expr());
+			return remember(l < r, l, r);
 		case OP_LE:
-			return (lhs->z3_expr() <= rhs->z3_expr());
+			return remember(l <= r, l, r);
 		case OP_GT:
-			return (lhs->z3_expr() > rhs->z3_expr());
+			return remember(l > r, l, r);
 		case OP_GE:
-			return (lhs->z3_expr() >= rhs->z3_expr());
+			return remember(l >= r, l, r);
 		}
-		return c.z3.bool_const(name.c_str());
+		return ast;
 	}
 
 	Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -373,7 +450,8 @@ public:
 	virtual ~Conjunction() {}
 
 	virtual z3::expr z3_expr() {
-		return (p->z3_expr() && q->z3_expr());
+		z3::expr a = p->z3_expr(), b = q->z3_expr();
+		return cached(a, b) ? ast : remember(a && b, a, b);
 	}
 
 	Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -404,7 +482,8 @@ public:
 	virtual ~Disjunction() {}
 
 	virtual z3::expr z3_expr() {
-		return (p->z3_expr() || q->z3_expr());
+		z3::expr a = p->z3_expr(), b = q->z3_expr();
+		return cached(a, b) ? ast : remember(a || b, a, b);
 	}
 
 	Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
@@ -435,7 +514,8 @@ public:
 	virtual ~Negation() {}
 
 	virtual z3::expr z3_expr() {
-		return !p->z3_expr();
+		z3::expr a = p->z3_expr();
+		return cached(a) ? ast : remember(!a, a);
 	}
 
 	Formula deep_copy(Context &c, std::function<Expr*(Context&, Expr*)> sub);
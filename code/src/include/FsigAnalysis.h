@@ -173,6 +173,16 @@ public:
 	}
 	llvm::StringRef get_sig(llvm::Value *v, path_iterator::Edge *in_edge = NULL);
 	void dump();
+
+	void memory(mem::Snapshot &S) const {
+		mem::Usage U(0, mem::of(sigs).bytes);
+		for (auto &V : sigs) {
+			mem::Usage E = mem::of(V.second);
+			U.entries += E.entries;
+			U.bytes += E.bytes;
+		}
+		S.add("fsig.signatures", U);
+	}
 };
 
 };
@@ -0,0 +1,104 @@
+//===---- MemLog.h - Memory accounting at stage boundaries ------*- C++ -*-===//
+
+#ifndef MEMLOG_H
+#define MEMLOG_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace rsc {
+
+/*
+ * Approximate memory accounting. Each large structure reports its entry
+ * count and an estimate of its bytes into a Snapshot under a stable name,
+ * and MemLog appends the snapshot, with the peak RSS of the process, as
+ * one JSON line per stage boundary:
+ *
+ *   {"stage": "slice", "peak_rss_kb": 123456, "rss_kb": 120000,
+ *    "structures": {"csr": {"entries": 10, "bytes": 640}, ...}}
+ *
+ * The estimates count the storage of the containers and of their elements
+ * (a std::map node is taken as four pointers plus the value), not what the
+ * elements point to, so they are lower bounds meant for comparing runs.
+ */
+namespace mem {
+
+struct Usage {
+	uint64_t entries, bytes;
+
+	Usage() : entries(0), bytes(0) {}
+	Usage(uint64_t entries, uint64_t bytes) : entries(entries), bytes(bytes) {}
+
+	Usage &operator+=(const Usage &U) {
+		entries += U.entries;
+		bytes += U.bytes;
+		return *this;
+	}
+};
+
+template <class T>
+Usage of(const std::vector<T> &v) {
+	return Usage(v.size(), v.capacity() * sizeof(T));
+}
+
+template <class K, class V, class C>
+Usage of(const std::map<K, V, C> &m) {
+	return Usage(m.size(),
+		     m.size() * (sizeof(std::pair<const K, V>) + 4 * sizeof(void*)));
+}
+
+template <class K, class V, class I>
+Usage of(const llvm::DenseMap<K, V, I> &m) {
+	return Usage(m.size(), m.getMemorySize());
+}
+
+template <class V, class I>
+Usage of(const llvm::DenseSet<V, I> &s) {
+	return Usage(s.size(), s.getMemorySize());
+}
+
+class Snapshot {
+	std::vector<std::pair<std::string, Usage>> parts;
+public:
+	void add(llvm::StringRef name, const Usage &U) {
+		parts.push_back(std::make_pair(name.str(), U));
+	}
+	const std::vector<std::pair<std::string, Usage>> &entries() const {
+		return parts;
+	}
+};
+
+// In kilobytes, 0 if unknown
+uint64_t peak_rss();
+uint64_t current_rss();
+
+// Bytes allocated by Z3 in this process, 0 if this Z3 cannot tell
+uint64_t z3_bytes();
+
+};
+
+class MemLog {
+	std::unique_ptr<llvm::raw_fd_ostream> os;
+
+public:
+	// Returns false if the log cannot be created
+	bool open(const std::string &file);
+	bool is_open() const { return os != nullptr; }
+
+	// Append one line; scc, if not empty, names the SCC just analyzed
+	void record(llvm::StringRef stage, const mem::Snapshot &S,
+		    llvm::StringRef scc = "");
+};
+
+};
+
+#endif  /* MEMLOG_H */
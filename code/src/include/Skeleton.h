@@ -0,0 +1,112 @@
+//===---- Skeleton.h - Per-function effect skeletons ------------*- C++ -*-===//
+
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Value.h"
+
+#include "CallGraphCSR.h"
+#include "MemLog.h"
+#include "TrivialLeaf.h"
+
+namespace rsc {
+
+/*
+ * The effect skeleton of a function: its body with everything the analyses
+ * do not look at dropped. Only three kinds of calls are kept, as events:
+ * primitives changing the atomic state (with their effects), sleeping
+ * primitives and calls of other functions with a body (with their site
+ * ids). Calls of external functions and trivial leaves are no-ops and
+ * vanish.
+ *
+ * An indirect call whose targets are not all of one kind, say a sleeping
+ * primitive and a function with a body, or two primitives with different
+ * effects, is kept as a call event as well. Its targets are alternatives,
+ * and an analysis must look at each of them by sleeps() and effect().
+ *
+ * The CFG is reduced to the blocks that hold events, branch or exit; a
+ * block without events falling through to a single successor is bypassed.
+ * Each kept block ends with an EV_END event, so a program point is just an
+ * index into events. Blocks are numbered in function order from the entry,
+ * and the condition of a block's branch, if any, is given a dense id.
+ */
+struct Skeleton {
+	enum EventKind { EV_EFFECT, EV_SLEEP, EV_CALL, EV_END };
+
+	struct Event {
+		EventKind kind;
+		unsigned arg;           // effects, site id or block id
+	};
+
+	static const unsigned NO_COND = ~0U;
+
+	std::vector<Event> events;
+	std::vector<unsigned> block_begin;
+	std::vector<unsigned> succ_off, succ_tgt;
+	std::vector<bool> is_exit;
+	std::vector<unsigned> cond;             // condition id of each block
+	std::vector<const llvm::BasicBlock*> origin;
+	unsigned nr_ir_blocks;                  // before the reduction
+
+	unsigned nr_blocks() const { return block_begin.size(); }
+	CallGraphCSR::Range successors(unsigned b) const {
+		return CallGraphCSR::Range(succ_tgt.data() + succ_off[b],
+					   succ_tgt.data() + succ_off[b + 1]);
+	}
+};
+
+/*
+ * The skeletons of all functions of a frozen call graph, extracted from
+ * the IR once, on first use, and shared by every analysis afterwards.
+ */
+class Skeletons {
+public:
+	typedef CallGraphCSR::FuncId FuncId;
+
+private:
+	const CallGraphCSR &graph;
+	const llvm::StringSet<> &sleepers;
+	const TrivialLeaves *trivial;
+	llvm::BitVector sleeper;                // by function
+	std::vector<uint8_t> effects;
+
+	std::vector<std::unique_ptr<Skeleton>> skeletons;
+	std::vector<const llvm::Value*> conds;
+	llvm::DenseMap<const llvm::Value*, unsigned> cond_ids;
+
+	void build(FuncId f, Skeleton &S);
+	unsigned cond_id(const llvm::Value *V);
+
+public:
+	// Calls to trivial leaves, if given, are pruned from the skeletons
+	Skeletons(const CallGraphCSR &G, const llvm::StringSet<> &sleepers,
+		  const TrivialLeaves *trivial = NULL);
+
+	const CallGraphCSR &call_graph() const { return graph; }
+
+	// trivial leaves are no-ops, just like external functions
+	bool has_body(FuncId f) const;
+
+	// A call of f sleeps or has these atomic effects; it is entered only
+	// if neither holds and it has a body
+	bool sleeps(FuncId f) const { return sleeper.test(f); }
+	unsigned effect(FuncId f) const { return effects[f]; }
+
+	// Only for functions with a body
+	const Skeleton &of(FuncId f);
+
+	const llvm::Value *condition(unsigned id) const { return conds[id]; }
+
+	void memory(mem::Snapshot &S) const;
+};
+
+};
+
+#endif  /* SKELETON_H */
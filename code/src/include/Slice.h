@@ -0,0 +1,87 @@
+//===---- Slice.h - Functions between atomic entries and sleeps -*- C++ -*-===//
+
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Function.h"
+
+#include "CallGraphCSR.h"
+#include "MemLog.h"
+
+namespace rsc {
+
+/*
+ * The sensitive slice of a call graph is the set of functions lying on some
+ * call path from a site entering atomic context to a call of a sleeping
+ * primitive. Only these functions can contribute to a sleep-in-atomic bug,
+ * so everything else may be skipped by the analysis.
+ *
+ * The slice is computed on the condensed call graph: a function is in the
+ * slice iff its SCC is reachable from an SCC containing an atomic entry site
+ * and can reach an SCC containing a sleeping call. Both directions are kept
+ * as bitsets over SCC ids, so the final intersection is word-parallel.
+ *
+ * A function that calls an atomic entry but no primitive leaving atomic
+ * context, directly or through such wrappers, returns with the lock held;
+ * its callers count as entry sites too. This is decided per SCC and
+ * without paths. A wrapper that also leaves atomic context on some path,
+ * e.g. unlocking on an error return, is taken as balanced, so what its
+ * callers call after it may be missing from the slice.
+ */
+class SensitiveSlice {
+	const llvm::StringSet<> &entries;
+	const llvm::StringSet<> &sleepers;
+
+	std::unique_ptr<CallGraphCSR> owned;
+	const CallGraphCSR *graph;
+	std::vector<unsigned> scc_of;
+	llvm::BitVector may_sleep_, in_atomic_, in_slice;  // indexed by SCC id
+
+	bool test(const llvm::BitVector &bits, const llvm::Function *F) const {
+		CallGraphCSR::FuncId f = graph ? graph->id(F) : CallGraphCSR::NONE;
+		return f != CallGraphCSR::NONE && bits.test(scc_of[f]);
+	}
+
+public:
+	SensitiveSlice(const llvm::StringSet<> &entries,
+		       const llvm::StringSet<> &sleepers)
+		: entries(entries), sleepers(sleepers), graph(NULL) {}
+
+	void compute(llvm::CallGraph &CG);
+	void compute(const CallGraphCSR &G);
+
+	bool contains(const llvm::Function *F) const { return test(in_slice, F); }
+
+	// F may reach a sleeping primitive / be reached from an atomic entry
+	bool may_sleep(const llvm::Function *F) const { return test(may_sleep_, F); }
+	bool in_atomic(const llvm::Function *F) const { return test(in_atomic_, F); }
+	unsigned size() const;
+	void memory(mem::Snapshot &S) const;
+
+	/*
+	 * Write the names of the functions in the slice as a text list, one
+	 * per line, for -sensilist.
+	 */
+	bool write(const std::string &file) const;
+};
+
+void addDefaultAtomicEntries(llvm::StringSet<> &names);
+void addDefaultSleepingPrimitives(llvm::StringSet<> &names);
+
+/*
+ * Condense a call graph into its SCCs. On return scc_of[f] holds the SCC id
+ * of function f. SCC ids are assigned in reverse topological order, i.e. a
+ * call f->g implies scc_of[f] >= scc_of[g]. Returns the number of SCCs.
+ */
+unsigned condense(const CallGraphCSR &G, std::vector<unsigned> &scc_of);
+
+};
+
+#endif  /* SLICE_H */
@@ -0,0 +1,59 @@
+//===---- Stats.h - Counters, histograms and stage timers -------*- C++ -*-===//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Trace.h"
+
+namespace rsc {
+
+/*
+ * A process-wide registry of named statistics, dumped as one JSON object by
+ * the -count pass. Unlike LLVM's STATISTIC it does not depend on an
+ * assertions build, and it also keeps histograms and stage times. Names are
+ * dotted, e.g. "tabulation.path_edges"; all updates are thread-safe.
+ *
+ * Histograms use power-of-two buckets: 0, 1, 2-3, 4-7, ...
+ */
+namespace stats {
+
+void add(llvm::StringRef counter, uint64_t n = 1);
+void sample(llvm::StringRef histogram, uint64_t value);
+void add_time(llvm::StringRef stage, double seconds);
+
+// Make a counter appear in the dump even if it is never bumped
+void declare(llvm::StringRef counter);
+
+uint64_t get(llvm::StringRef counter);
+
+void print_json(llvm::raw_ostream &OS);
+void reset();
+
+// Adds the wall time of its lifetime to a stage, and traces it
+class StageTimer {
+	std::string stage;
+	std::chrono::steady_clock::time_point start;
+	trace::Span span;
+public:
+	explicit StageTimer(llvm::StringRef stage)
+		: stage(stage.str()), start(std::chrono::steady_clock::now()),
+		  span(stage) {}
+	~StageTimer() {
+		std::chrono::duration<double> d =
+			std::chrono::steady_clock::now() - start;
+		add_time(stage, d.count());
+	}
+};
+
+};
+
+};
+
+#endif  /* STATS_H */
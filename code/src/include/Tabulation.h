@@ -0,0 +1,324 @@
+//===---- Tabulation.h - Context-sensitive atomic state ---------*- C++ -*-===//
+
+#ifndef TABULATION_H
+#define TABULATION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "CallGraphCSR.h"
+#include "MemLog.h"
+#include "Skeleton.h"
+
+namespace rsc {
+
+/*
+ * The atomic state of a program point is a small finite fact: whether
+ * interrupts are off, whether a raw spinlock is held, and the preemption
+ * nesting depth. The depth saturates at MAX_DEPTH, and a saturated depth
+ * is never decremented, so the state stays (conservatively) atomic.
+ */
+namespace atomic {
+
+typedef uint8_t Fact;
+
+enum {
+	IRQ_OFF   = 1 << 0,
+	RAW_LOCK  = 1 << 1,
+	DEPTH_SHIFT = 2,
+	MAX_DEPTH = 3,
+	NR_FACTS  = 1 << 4,
+};
+
+// Effects of the primitives that change the atomic state
+enum Effect {
+	E_IRQ_OFF     = 1 << 0,
+	E_IRQ_ON      = 1 << 1,
+	E_PREEMPT_OFF = 1 << 2,
+	E_PREEMPT_ON  = 1 << 3,
+	E_LOCK        = 1 << 4,
+	E_UNLOCK      = 1 << 5,
+};
+
+inline unsigned depth(Fact d) { return d >> DEPTH_SHIFT; }
+inline bool in_atomic(Fact d) { return (d & IRQ_OFF) || depth(d) != 0; }
+
+/*
+ * Facts are ordered by how atomic they are: a covers b if it has every
+ * flag of b and at least its depth. apply() and in_atomic() are monotone
+ * in this order, so whatever is reached from b is covered by what is
+ * reached from a.
+ */
+inline bool covers(Fact a, Fact b) {
+	return (b & ~a & (IRQ_OFF | RAW_LOCK)) == 0 && depth(b) <= depth(a);
+}
+
+// The least fact covering both
+inline Fact join(Fact a, Fact b) {
+	return ((a | b) & (IRQ_OFF | RAW_LOCK)) |
+		(std::max(depth(a), depth(b)) << DEPTH_SHIFT);
+}
+
+Fact apply(Fact d, unsigned effects);
+
+/*
+ * Effects of calling the named function, 0 if it does not touch the
+ * atomic state.
+ */
+unsigned effect_of(llvm::StringRef name);
+
+std::string to_string(Fact d);
+
+};
+
+/*
+ * An IFDS-style tabulation solver for the atomic state over a frozen call
+ * graph. For each (function, entry fact) pair that is reached, it computes
+ * the set of facts that hold at the function's exits; the summary is
+ * computed once and reused at every call site entering the function in
+ * that state, so callees are never re-analyzed per call chain. The cost is
+ * bounded by functions x blocks x facts^2 instead of the number of call
+ * chains.
+ *
+ * Inside a function, only its effect skeleton is walked: calls of
+ * primitives with an atomic effect, calls of sleeping primitives and calls
+ * of other functions, over the reduced CFG. A report is produced whenever
+ * a sleeping primitive is reached in an atomic fact.
+ *
+ * No paths are kept while propagating. The only record of how a summary
+ * was reached is its incoming caller edges (caller function, return point,
+ * caller entry fact), so memory stays proportional to the facts. The call
+ * chain of a report is rebuilt on demand by a BFS over these edges, and the
+ * path inside each function by a BFS over its events and callee summaries;
+ * both yield the shortest witness.
+ *
+ * Each function may be given a budget of processed path edges and wall
+ * time. A function running out of it is degraded: from then
+ * on it is analyzed flow-insensitively, as if its events could run in any
+ * order, which over-approximates the facts of every path at the cost of
+ * events x facts per entry. Its reports stay sound but may be spurious, and
+ * their in-function paths cannot be rebuilt.
+ *
+ * The number of summaries (entry facts) per function may be capped as
+ * well. Past the cap, a call entering the function in a new fact reuses
+ * the most precise existing summary whose entry covers it, or else a
+ * widened one whose entry covers all of them; as facts are ordered and
+ * the order has a small height, only a few widened summaries are ever
+ * added. Both only add atomic states, so no report is lost.
+ */
+class AtomicTabulation {
+public:
+	typedef atomic::Fact Fact;
+	typedef CallGraphCSR::FuncId FuncId;
+	typedef CallGraphCSR::SiteId SiteId;
+
+	struct Report {
+		SiteId site;            // call of the sleeping primitive
+		Fact fact;              // atomic state at the call
+		FuncId func;            // function containing the call
+		Fact entry;             // entry fact of that function
+		unsigned point;         // event of the call
+	};
+
+	/*
+	 * One function on a witness, from its entry to the site where the
+	 * chain continues (a call, or the sleeping primitive for the last).
+	 */
+	struct Step {
+		FuncId func;
+		Fact entry;
+		std::vector<unsigned> blocks;   // skeleton blocks, entry first
+		SiteId site;
+		Fact fact;              // atomic state at the site
+	};
+
+	// Limits per function, 0 for none
+	struct Budget {
+		uint64_t steps;         // path edges processed
+		double seconds;         // time spent processing them
+
+		Budget() : steps(0), seconds(0) {}
+		bool empty() const { return !steps && seconds <= 0; }
+	};
+
+	enum Exhausted { OUT_OF_STEPS, OUT_OF_TIME };
+
+	struct Degraded {
+		FuncId func;
+		Exhausted reason;
+	};
+
+	// An incoming caller edge, callee entered in fact from caller
+	struct CallEdge {
+		FuncId callee;
+		Fact fact;
+		FuncId caller;
+		Fact entry;             // entry fact of the caller
+		unsigned point;         // return point in the caller
+	};
+
+	// A sleeping primitive reached in an atomic fact inside a summary
+	struct Sleep {
+		SiteId site;
+		Fact fact;
+		unsigned point;         // event of the call
+	};
+
+	// What exploring a function in one entry fact found
+	struct Summary {
+		unsigned exits;
+		std::vector<CallEdge> calls;    // made by the function
+		std::vector<Sleep> sleeps;
+	};
+
+private:
+	typedef Skeleton Body;
+	typedef Skeleton::Event Event;
+
+	struct PathEdge {
+		FuncId func;
+		Fact entry;
+		unsigned point;
+		Fact fact;
+	};
+
+	struct Caller {
+		FuncId func;
+		Fact entry;
+		unsigned point;         // return point in the caller
+	};
+
+	// The single point of a degraded function, which has no real ones
+	static const unsigned DEGRADED_POINT = (1U << 24) - 1;
+
+	/*
+	 * Path edge keys hold the function in their upper half, which the
+	 * default hash of 64-bit keys (truncating val * 37) drops entirely.
+	 */
+	struct EdgeKeyInfo {
+		static uint64_t getEmptyKey() { return ~0ULL; }
+		static uint64_t getTombstoneKey() { return ~0ULL - 1; }
+		static unsigned getHashValue(uint64_t k) {
+			return (unsigned)((k * 0x9E3779B97F4A7C15ULL) >> 32);
+		}
+		static bool isEqual(uint64_t a, uint64_t b) { return a == b; }
+	};
+
+	Skeletons &skeletons;
+	const CallGraphCSR &graph;
+
+	std::vector<PathEdge> worklist;
+	llvm::DenseSet<uint64_t, EdgeKeyInfo> path_edges;
+	llvm::DenseMap<unsigned, unsigned> end_summary;      // (f, d) -> exits
+	llvm::DenseMap<unsigned, std::vector<Caller>> incoming;
+	llvm::DenseSet<unsigned> roots;                      // (f, d) entries
+	llvm::DenseSet<unsigned> reported;                   // (site, d)
+	std::vector<Report> reports_;
+	llvm::DenseSet<uint64_t, EdgeKeyInfo> sleep_edges;   // as path edges
+	llvm::DenseMap<unsigned, std::vector<Sleep>> sleeps_;
+	llvm::DenseMap<unsigned, Summary> restored;
+	uint64_t iterations;                                 // path edges processed
+
+	Budget budget;
+	std::vector<uint64_t> steps;                         // by function
+	std::vector<double> seconds;
+	llvm::BitVector degraded_;
+	std::vector<Degraded> degraded_list;
+
+	unsigned summary_cap;
+	std::vector<uint16_t> entry_mask;                    // by function
+	llvm::DenseMap<unsigned, Fact> widened;              // (f, d) -> entry
+
+	static unsigned key(FuncId f, Fact d) {
+		return (f << 4) | d;
+	}
+
+	bool has_body(FuncId f) const { return skeletons.has_body(f); }
+	const Body &body(FuncId f) { return skeletons.of(f); }
+
+	void propagate(FuncId f, Fact entry, unsigned point, Fact d);
+	void add_exit(FuncId f, Fact entry, Fact d);
+	void reach_sleep(FuncId f, Fact entry, unsigned point, SiteId s, Fact d);
+	void replay(FuncId f, Fact entry, const Summary &S);
+	void process(const PathEdge &e);
+	void process_degraded(const PathEdge &e);
+	void charge(FuncId f, double elapsed);
+	void degrade(FuncId f, Exhausted reason);
+
+	Fact widen(FuncId f, Fact d);
+	Fact entry_of(FuncId f, Fact d) const;
+
+	unsigned block_of(const Body &B, unsigned point) const;
+	bool rebuild_path(FuncId f, Fact entry, unsigned target, Fact fact,
+			  std::vector<unsigned> &blocks);
+	bool build_chain(FuncId f, Fact entry, unsigned point, Fact fact,
+			 std::vector<Step> &chain);
+
+public:
+	explicit AtomicTabulation(Skeletons &S);
+
+	// Before solve(); functions out of budget are degraded
+	void set_budget(const Budget &B);
+
+	// Before solve(); summaries per function past which entries widen
+	void set_summary_cap(unsigned cap);
+
+	bool is_degraded(FuncId f) const {
+		return f < degraded_.size() && degraded_.test(f);
+	}
+	const std::vector<Degraded> &degraded() const { return degraded_list; }
+
+	// Analyze f when entered in state d
+	void add_entry(FuncId f, Fact d = 0);
+	void solve();
+
+	// Facts at the exits of f when entered in state d, as a bitmask
+	unsigned exits(FuncId f, Fact d) const;
+
+	const std::vector<Report> &reports() const { return reports_; }
+
+	/*
+	 * Rebuild the shortest witness of R, from an entry added with
+	 * add_entry() down to the sleeping primitive. Returns false if no
+	 * witness is found, which only happens for unreachable reports.
+	 */
+	bool witness(const Report &R, std::vector<Step> &chain);
+
+	// The shortest chain of calls entering f in state d, without f itself
+	bool chain_to(FuncId f, Fact d, std::vector<Step> &chain);
+
+	// Entry facts reached for f, as a bitmask
+	unsigned entries(FuncId f) const;
+
+	/*
+	 * Restore a summary of an earlier run before solve(), for a function
+	 * whose body and callees have not changed. Nothing is taken as reached:
+	 * once a call enters f in state d, the summary replays its calls and
+	 * sleeping primitives instead of exploring the body, so its callees
+	 * and reports are reached through it, and its exits are used as given.
+	 */
+	void add_summary(FuncId f, Fact d, const Summary &S);
+
+	// After solve(), for building the summaries of a later run
+	void callers(std::vector<CallEdge> &edges) const;
+	const std::vector<Sleep> &sleeps(FuncId f, Fact d) const;
+
+	unsigned nr_summaries() const { return end_summary.size(); }
+	unsigned nr_path_edges() const { return path_edges.size(); }
+	uint64_t nr_iterations() const { return iterations; }
+	unsigned nr_widened() const { return widened.size(); }
+
+	void memory(mem::Snapshot &S) const;
+};
+
+};
+
+#endif  /* TABULATION_H */
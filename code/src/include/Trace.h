@@ -0,0 +1,60 @@
+//===---- Trace.h - Chrome trace-format timeline ----------------*- C++ -*-===//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace rsc {
+
+/*
+ * An opt-in tracer writing the Chrome trace event format, which both
+ * chrome://tracing and ui.perfetto.dev load. Spans are complete events
+ * ("ph": "X") on the thread that recorded them, so spans opened inside
+ * another one show up nested, e.g. the functions of an SCC under it.
+ *
+ * Recording appends to a buffer owned by the calling thread, without any
+ * locking; the buffers are only merged when the trace is written. While
+ * no trace is started, a Span costs one test of a global flag.
+ */
+namespace trace {
+
+enum Category { STAGE, MODULE, SCC, FUNCTION };
+
+extern bool enabled;
+
+// Start recording; the trace is written to file by finish() or at exit
+bool start(const std::string &file);
+void finish();
+
+// Microseconds since start()
+uint64_t now();
+void record(llvm::StringRef name, Category cat, uint64_t begin, uint64_t end);
+
+class Span {
+	bool active;
+	Category cat;
+	std::string name;
+	uint64_t begin;
+public:
+	explicit Span(llvm::StringRef name, Category cat = STAGE)
+		: active(enabled), cat(cat), begin(0) {
+		if (active) {
+			this->name = name.str();
+			begin = now();
+		}
+	}
+	~Span() {
+		if (active)
+			record(name, cat, begin, now());
+	}
+};
+
+};
+
+};
+
+#endif  /* TRACE_H */
@@ -0,0 +1,52 @@
+//===---- TrivialLeaf.h - Functions with no effect at all -------*- C++ -*-===//
+
+#ifndef TRIVIAL_LEAF_H
+#define TRIVIAL_LEAF_H
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Function.h"
+
+#include "CallGraphCSR.h"
+#include "MemLog.h"
+
+namespace rsc {
+
+/*
+ * A trivial leaf is a defined function that calls nothing (intrinsics
+ * aside), contains no inline asm and is not itself a primitive changing
+ * the atomic state or sleeping. Such a function can neither sleep nor
+ * change the atomic state, so its summary is the constant "no effect":
+ * the analyses skip it and treat calls to it as no-ops.
+ *
+ * This generalizes the hand-written scripts/inline-list (ERR_PTR, IS_ERR,
+ * ...), whose names are always treated as trivial leaves.
+ */
+class TrivialLeaves {
+	const CallGraphCSR *graph;
+	llvm::BitVector leaf;                              // indexed by FuncId
+
+public:
+	TrivialLeaves() : graph(NULL) {}
+
+	void compute(const CallGraphCSR &G, const llvm::StringSet<> &inlined,
+		     const llvm::StringSet<> &sleepers);
+
+	bool contains(CallGraphCSR::FuncId f) const {
+		return f != CallGraphCSR::NONE && leaf.test(f);
+	}
+	bool contains(const llvm::Function *F) const {
+		return graph && contains(graph->id(F));
+	}
+	unsigned size() const { return leaf.count(); }
+	void memory(mem::Snapshot &S) const {
+		S.add("trivial_leaves", mem::Usage(size(), leaf.size() / 8));
+	}
+};
+
+// The body test alone, for passes without a call graph
+bool isTrivialLeaf(const llvm::Function &F);
+
+};
+
+#endif  /* TRIVIAL_LEAF_H */
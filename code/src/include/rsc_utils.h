@@ -1,10 +1,10 @@
 #pragma once
 
-#include <llvm/Module.h>
-#include <llvm/Type.h>
-#include <llvm/Instructions.h>
-#include <llvm/IntrinsicInst.h>
-#include <llvm/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/Support/Path.h>
 #include <string>
 #include <llvm/Support/Debug.h>
@@ -21,7 +21,7 @@ static inline bool isFunctionPointer(llvm::Type *Ty) {
 
 static inline std::string getScopeName(llvm::GlobalValue *GV) {
 	if (llvm::GlobalValue::isExternalLinkage(GV->getLinkage()))
-		return GV->getName();
+		return GV->getName().str();
 	else {
 		llvm::StringRef moduleName = llvm::sys::path::stem(
 			GV->getParent()->getModuleIdentifier());
@@ -46,6 +46,15 @@ static inline llvm::StringRef getLoadStoreId(llvm::Instruction *I) {
 	return llvm::StringRef();
 }
 
+// Kind is the ID of MD_ID; looking it up by name may insert into the
+// context, so threads must resolve it beforehand
+static inline llvm::StringRef
+getLoadStoreId(llvm::Instruction *I, unsigned Kind) {
+	if (llvm::MDNode *MD = I->getMetadata(Kind))
+		return llvm::dyn_cast<llvm::MDString>(MD->getOperand(0))->getString();
+	return llvm::StringRef();
+}
+
 static inline std::string
 getStructId(llvm::Type *Ty, llvm::Module *M, unsigned offset) {
 	llvm::StructType *STy = llvm::dyn_cast<llvm::StructType>(Ty);
@@ -89,10 +98,10 @@ static inline std::string getValueId(llvm::Value *V) {
 	else if (llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(V)) {
 		if (llvm::Function *F = CI->getCalledFunction())
 			if (F->getName().startswith("kint_arg.i"))
-				return getLoadStoreId(CI);
+				return getLoadStoreId(CI).str();
 		return getRetId(CI);
 	} else if (llvm::isa<llvm::LoadInst>(V) || llvm::isa<llvm::StoreInst>(V))
-		return getLoadStoreId(llvm::dyn_cast<llvm::Instruction>(V));
+		return getLoadStoreId(llvm::dyn_cast<llvm::Instruction>(V)).str();
 	return "";
 }
 
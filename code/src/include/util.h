@@ -6,8 +6,10 @@
 #include <string>
 #include <set>
 #include <list>
+#include <vector>
 #include <algorithm>
 
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
@@ -16,6 +18,26 @@ namespace rsc {
 
 llvm::StringRef getFunctionName(llvm::Function *F);
 
+/*
+ * Read a list of function names, one per line, into a hashed set. Empty
+ * lines are ignored. Returns false if the file cannot be opened.
+ */
+bool readFunctionList(const std::string &file, llvm::StringSet<> &names);
+
+/*
+ * Write names in the format readFunctionList() reads, which is also what
+ * the -sensilist option of the external passes expects.
+ */
+bool writeFunctionList(const std::string &file,
+		       const std::vector<llvm::StringRef> &names);
+
+/*
+ * Whether two functions, possibly of different modules, have the same body
+ * up to debug info and metadata. Types are compared by structure, as struct
+ * types are renamed when a module is parsed again into the same context.
+ */
+bool sameBody(llvm::Function *A, llvm::Function *B);
+
 }; //end of namespace rsc
 
-#endif /** UTIL_H **/
\ No newline at end of file
+#endif /** UTIL_H **/
@@ -0,0 +1,130 @@
+#include "CallGraphCSR.h"
+
+#include <algorithm>
+
+#include <llvm/IR/Module.h>
+
+using namespace llvm;
+
+namespace rsc {
+
+/*
+ * Turn a list of (source, target) pairs into CSR arrays over n sources,
+ * dropping duplicate edges. The pairs are consumed.
+ */
+static void to_csr(std::vector<std::pair<unsigned, unsigned>> &edges, unsigned n,
+		   std::vector<unsigned> &off, std::vector<unsigned> &tgt) {
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	off.assign(n + 1, 0);
+	for (auto &e : edges)
+		++off[e.first + 1];
+	for (unsigned i = 0; i < n; ++i)
+		off[i + 1] += off[i];
+
+	tgt.resize(edges.size());
+	for (unsigned i = 0; i < edges.size(); ++i)
+		tgt[i] = edges[i].second;
+
+	std::vector<std::pair<unsigned, unsigned>>().swap(edges);
+}
+
+CallGraphCSR::FuncId CallGraphCSR::add_function(Function *F) {
+	assert(!frozen);
+	auto it = func_ids.find(F);
+	if (it != func_ids.end())
+		return it->second;
+	func_ids[F] = funcs.size();
+	funcs.push_back(F);
+	return funcs.size() - 1;
+}
+
+CallGraphCSR::SiteId CallGraphCSR::add_site(CallInst *CI) {
+	assert(!frozen);
+	auto it = site_ids.find(CI);
+	if (it != site_ids.end())
+		return it->second;
+	site_ids[CI] = sites.size();
+	sites.push_back(CI);
+	site_caller.push_back(add_function(CI->getParent()->getParent()));
+	return sites.size() - 1;
+}
+
+CallGraphCSR::SiteId CallGraphCSR::add_site(Function *Caller) {
+	assert(!frozen);
+	sites.push_back(NULL);
+	site_caller.push_back(add_function(Caller));
+	return sites.size() - 1;
+}
+
+void CallGraphCSR::add_edge(SiteId site, Function *callee) {
+	assert(!frozen);
+	pending.push_back(std::make_pair(site, add_function(callee)));
+}
+
+void CallGraphCSR::freeze() {
+	assert(!frozen);
+	unsigned nf = funcs.size(), ns = sites.size();
+
+	std::vector<std::pair<unsigned, unsigned>> fedges, redges, sedges;
+	fedges.reserve(pending.size());
+	redges.reserve(pending.size());
+	for (auto &e : pending) {
+		fedges.push_back(std::make_pair(site_caller[e.first], e.second));
+		redges.push_back(std::make_pair(e.second, site_caller[e.first]));
+	}
+	for (SiteId s = 0; s < ns; ++s)
+		sedges.push_back(std::make_pair(site_caller[s], s));
+
+	to_csr(pending, ns, site_off, site_tgt);
+	to_csr(fedges, nf, callee_off, callee_tgt);
+	to_csr(redges, nf, caller_off, caller_tgt);
+	to_csr(sedges, nf, fsite_off, fsite_tgt);
+
+	frozen = true;
+}
+
+void CallGraphCSR::build(CallGraph &CG) {
+	for (Function &F : CG.getModule())
+		add_function(&F);
+
+	for (Function &F : CG.getModule()) {
+		for (auto &CR : *CG[&F]) {
+			CallInst *CI = dyn_cast_or_null<CallInst>(
+					static_cast<Value *>(CR.first));
+			if (!CI)
+				continue;
+			SiteId s = add_site(CI);
+			if (Function *Callee = CR.second->getFunction())
+				add_edge(s, Callee);
+		}
+	}
+
+	freeze();
+}
+
+void CallGraphCSR::memory(mem::Snapshot &S) const {
+	mem::Usage F = mem::of(funcs);
+	F += mem::of(func_ids);
+	F.entries = funcs.size();
+	S.add("csr.functions", F);
+
+	mem::Usage St = mem::of(sites);
+	St += mem::of(site_ids);
+	St += mem::of(site_caller);
+	St.entries = sites.size();
+	S.add("csr.sites", St);
+
+	mem::Usage E = mem::of(pending);
+	const std::vector<unsigned> *arrays[] = {
+		&site_off, &site_tgt, &callee_off, &callee_tgt,
+		&caller_off, &caller_tgt, &fsite_off, &fsite_tgt,
+	};
+	for (const std::vector<unsigned> *A : arrays)
+		E += mem::of(*A);
+	E.entries = pending.size() + site_tgt.size();
+	S.add("csr.edges", E);
+}
+
+};
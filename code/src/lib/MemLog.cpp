@@ -0,0 +1,79 @@
+#include "MemLog.h"
+
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <z3.h>
+
+#include <llvm/Support/FileSystem.h>
+
+using namespace llvm;
+
+namespace rsc {
+namespace mem {
+
+uint64_t peak_rss() {
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+	return ru.ru_maxrss;                    // already in KB on Linux
+}
+
+uint64_t current_rss() {
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	unsigned long size, resident;
+	int n = fscanf(f, "%lu %lu", &size, &resident);
+	fclose(f);
+	if (n != 2)
+		return 0;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+uint64_t z3_bytes() {
+#ifdef HAVE_Z3_ALLOC_SIZE
+	return Z3_get_estimated_alloc_size();
+#else
+	return 0;
+#endif
+}
+
+};
+
+bool MemLog::open(const std::string &file) {
+	std::error_code EC;
+	os.reset(new raw_fd_ostream(file, EC, sys::fs::F_None));
+	if (EC) {
+		os.reset();
+		return false;
+	}
+	return true;
+}
+
+void MemLog::record(StringRef stage, const mem::Snapshot &S, StringRef scc) {
+	if (!os)
+		return;
+
+	raw_fd_ostream &OS = *os;
+	OS << "{\"stage\": \"" << stage << "\"";
+	if (!scc.empty())
+		OS << ", \"scc\": \"" << scc << "\"";
+	OS << ", \"peak_rss_kb\": " << mem::peak_rss()
+	   << ", \"rss_kb\": " << mem::current_rss();
+	if (uint64_t z3 = mem::z3_bytes())
+		OS << ", \"z3_bytes\": " << z3;
+
+	OS << ", \"structures\": {";
+	const char *sep = "";
+	for (auto &P : S.entries()) {
+		OS << sep << "\"" << P.first << "\": {\"entries\": "
+		   << P.second.entries << ", \"bytes\": " << P.second.bytes << "}";
+		sep = ", ";
+	}
+	OS << "}}\n";
+	OS.flush();
+}
+
+};
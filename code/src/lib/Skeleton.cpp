@@ -0,0 +1,211 @@
+#include "Skeleton.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+
+#include "Tabulation.h"
+#include "util.h"
+
+using namespace llvm;
+
+namespace rsc {
+
+Skeletons::Skeletons(const CallGraphCSR &G, const StringSet<> &sleepers,
+		     const TrivialLeaves *trivial)
+	: graph(G), sleepers(sleepers), trivial(trivial) {
+	assert(G.is_frozen());
+	skeletons.resize(G.nr_functions());
+
+	sleeper.resize(G.nr_functions());
+	effects.resize(G.nr_functions());
+	for (FuncId f = 0; f < G.nr_functions(); ++f) {
+		StringRef name = getFunctionName(G.function(f));
+		if (sleepers.count(name))
+			sleeper.set(f);
+		else
+			effects[f] = atomic::effect_of(name);
+	}
+}
+
+bool Skeletons::has_body(FuncId f) const {
+	if (trivial && trivial->contains(f))
+		return false;
+	return !graph.function(f)->empty();
+}
+
+const Skeleton &Skeletons::of(FuncId f) {
+	if (!skeletons[f]) {
+		skeletons[f].reset(new Skeleton());
+		build(f, *skeletons[f]);
+	}
+	return *skeletons[f];
+}
+
+unsigned Skeletons::cond_id(const Value *V) {
+	auto it = cond_ids.find(V);
+	if (it != cond_ids.end())
+		return it->second;
+	unsigned id = conds.size();
+	conds.push_back(V);
+	cond_ids[V] = id;
+	return id;
+}
+
+void Skeletons::build(FuncId f, Skeleton &S) {
+	Function *F = graph.function(f);
+
+	std::vector<BasicBlock*> blocks;
+	DenseMap<const BasicBlock*, unsigned> ir_ids;
+	for (BasicBlock &BB : *F) {
+		ir_ids[&BB] = blocks.size();
+		blocks.push_back(&BB);
+	}
+	unsigned n = blocks.size();
+	S.nr_ir_blocks = n;
+
+	// events of every IR block, flat
+	std::vector<Skeleton::Event> events;
+	std::vector<unsigned> event_off(1, 0);
+	std::vector<bool> kept(n);
+	for (unsigned b = 0; b < n; ++b) {
+		for (Instruction &I : *blocks[b]) {
+			CallInst *CI = dyn_cast<CallInst>(&I);
+			if (!CI)
+				continue;
+			CallGraphCSR::SiteId s = graph.id(CI);
+			if (s == CallGraphCSR::NONE)
+				continue;
+
+			// classify the site by its targets, as the slice does; a
+			// site of mixed targets stays a call of alternatives
+			bool sleeps = false, calls = false, noops = false;
+			unsigned effect = 0, nr_effects = 0;
+			for (FuncId t : graph.targets(s)) {
+				if (this->sleeps(t)) {
+					sleeps = true;
+				} else if (unsigned e = this->effect(t)) {
+					if (e != effect)
+						++nr_effects;
+					effect = e;
+				} else if (has_body(t)) {
+					calls = true;
+				} else {
+					noops = true;
+				}
+			}
+
+			Skeleton::Event ev;
+			if (sleeps && !nr_effects && !calls) {
+				ev.kind = Skeleton::EV_SLEEP;
+				ev.arg = s;
+			} else if (nr_effects == 1 && !sleeps && !calls && !noops) {
+				ev.kind = Skeleton::EV_EFFECT;
+				ev.arg = effect;
+			} else if (sleeps || nr_effects || calls) {
+				ev.kind = Skeleton::EV_CALL;
+				ev.arg = s;
+			} else {
+				continue;
+			}
+			events.push_back(ev);
+		}
+		event_off.push_back(events.size());
+
+		kept[b] = b == 0 || event_off[b + 1] != event_off[b]
+			|| !blocks[b]->getSingleSuccessor();
+	}
+
+	// a bypassed block stands for the first kept block it falls into
+	const unsigned UNRESOLVED = CallGraphCSR::NONE, PENDING = UNRESOLVED - 1;
+	std::vector<unsigned> target(n, UNRESOLVED);
+	for (unsigned b = 0; b < n; ++b)
+		if (kept[b])
+			target[b] = b;
+	for (unsigned b = 0; b < n; ++b) {
+		std::vector<unsigned> chain;
+		unsigned x = b;
+		while (target[x] == UNRESOLVED) {
+			target[x] = PENDING;
+			chain.push_back(x);
+			x = ir_ids[blocks[x]->getSingleSuccessor()];
+		}
+		// a loop of empty blocks keeps one of them
+		if (target[x] == PENDING) {
+			kept[x] = true;
+			target[x] = x;
+		}
+		for (unsigned c : chain)
+			if (c != x)
+				target[c] = target[x];
+	}
+
+	std::vector<unsigned> ids(n);
+	unsigned nr_blocks = 0;
+	for (unsigned b = 0; b < n; ++b)
+		if (kept[b])
+			ids[b] = nr_blocks++;
+
+	S.succ_off.push_back(0);
+	for (unsigned b = 0; b < n; ++b) {
+		if (!kept[b])
+			continue;
+		BasicBlock *BB = blocks[b];
+
+		S.block_begin.push_back(S.events.size());
+		S.events.insert(S.events.end(), events.begin() + event_off[b],
+				events.begin() + event_off[b + 1]);
+		Skeleton::Event end = { Skeleton::EV_END, ids[b] };
+		S.events.push_back(end);
+
+		unsigned first = S.succ_tgt.size();
+		for (BasicBlock *Succ : successors(BB)) {
+			unsigned t = ids[target[ir_ids[Succ]]];
+			if (std::find(S.succ_tgt.begin() + first, S.succ_tgt.end(), t)
+			    == S.succ_tgt.end())
+				S.succ_tgt.push_back(t);
+		}
+		S.succ_off.push_back(S.succ_tgt.size());
+
+		const Value *C = NULL;
+		if (BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator())) {
+			if (BI->isConditional())
+				C = BI->getCondition();
+		} else if (SwitchInst *SI = dyn_cast<SwitchInst>(BB->getTerminator())) {
+			C = SI->getCondition();
+		}
+		bool branches = S.succ_tgt.size() - first > 1;
+		S.cond.push_back(C && branches ? cond_id(C) : Skeleton::NO_COND);
+
+		S.is_exit.push_back(isa<ReturnInst>(BB->getTerminator()));
+		S.origin.push_back(BB);
+	}
+
+	// points are 24 bits in the tabulation's path edge keys
+	assert(S.events.size() < (1U << 24) && "function too large");
+}
+
+void Skeletons::memory(mem::Snapshot &S) const {
+	mem::Usage U(0, mem::of(skeletons).bytes);
+	for (const std::unique_ptr<Skeleton> &P : skeletons) {
+		if (!P)
+			continue;
+		U.entries += P->events.size();
+		U.bytes += sizeof(Skeleton) + mem::of(P->events).bytes
+			+ mem::of(P->block_begin).bytes + mem::of(P->succ_off).bytes
+			+ mem::of(P->succ_tgt).bytes + P->is_exit.capacity() / 8
+			+ mem::of(P->cond).bytes + mem::of(P->origin).bytes;
+	}
+	S.add("skeletons", U);
+	S.add("skeletons.targets",
+	      mem::Usage(effects.size(), sleeper.getMemorySize() +
+			 mem::of(effects).bytes));
+	S.add("skeletons.conditions",
+	      mem::Usage(conds.size(), mem::of(conds).bytes +
+			 mem::of(cond_ids).bytes));
+}
+
+};
@@ -0,0 +1,208 @@
+#include "Slice.h"
+
+#include <utility>
+
+#include <llvm/IR/Module.h>
+
+#include "Tabulation.h"
+#include "util.h"
+
+using namespace llvm;
+
+namespace rsc {
+
+unsigned condense(const CallGraphCSR &G, std::vector<unsigned> &scc_of) {
+	const unsigned UNVISITED = ~0U;
+	unsigned n = G.nr_functions(), index = 0, nr_sccs = 0;
+
+	std::vector<unsigned> dfsnum(n, UNVISITED), lowest(n);
+	std::vector<bool> on_stack(n, false);
+	std::vector<unsigned> stack;
+	std::vector<std::pair<unsigned, unsigned>> frames;   // node, next succ
+
+	scc_of.assign(n, UNVISITED);
+
+	// Iterative Tarjan, kernel call chains are too deep for recursion
+	for (unsigned root = 0; root < n; ++root) {
+		if (dfsnum[root] != UNVISITED)
+			continue;
+		frames.push_back(std::make_pair(root, 0));
+		dfsnum[root] = lowest[root] = index++;
+		stack.push_back(root);
+		on_stack[root] = true;
+
+		while (!frames.empty()) {
+			unsigned v = frames.back().first;
+			unsigned &next = frames.back().second;
+
+			CallGraphCSR::Range succs = G.callees(v);
+			if (next < succs.size()) {
+				unsigned w = succs.begin()[next++];
+				if (dfsnum[w] == UNVISITED) {
+					dfsnum[w] = lowest[w] = index++;
+					stack.push_back(w);
+					on_stack[w] = true;
+					frames.push_back(std::make_pair(w, 0));
+				} else if (on_stack[w]) {
+					lowest[v] = std::min(lowest[v], dfsnum[w]);
+				}
+				continue;
+			}
+
+			if (lowest[v] == dfsnum[v]) {
+				unsigned w;
+				do {
+					w = stack.back();
+					stack.pop_back();
+					on_stack[w] = false;
+					scc_of[w] = nr_sccs;
+				} while (w != v);
+				++nr_sccs;
+			}
+
+			frames.pop_back();
+			if (!frames.empty()) {
+				unsigned u = frames.back().first;
+				lowest[u] = std::min(lowest[u], lowest[v]);
+			}
+		}
+	}
+
+	return nr_sccs;
+}
+
+void SensitiveSlice::compute(CallGraph &CG) {
+	owned.reset(new CallGraphCSR());
+	owned->build(CG);
+	compute(*owned);
+}
+
+void SensitiveSlice::compute(const CallGraphCSR &G) {
+	graph = &G;
+	unsigned n = G.nr_functions();
+
+	const unsigned release = atomic::E_IRQ_ON | atomic::E_PREEMPT_ON
+		| atomic::E_UNLOCK;
+	BitVector has_entry(n), has_exit(n), has_sleep(n);
+	for (unsigned i = 0; i < n; ++i) {
+		for (unsigned j : G.callees(i)) {
+			StringRef name = getFunctionName(G.function(j));
+			if (entries.count(name))
+				has_entry.set(i);
+			if (atomic::effect_of(name) & release)
+				has_exit.set(i);
+			if (sleepers.count(name))
+				has_sleep.set(i);
+		}
+	}
+
+	unsigned nr_sccs = condense(G, scc_of);
+
+	std::vector<std::vector<unsigned>> members(nr_sccs);
+	for (unsigned i = 0; i < n; ++i)
+		members[scc_of[i]].push_back(i);
+
+	// Callees come first, so may_sleep is final once an SCC is reached.
+	// An SCC that enters atomic context, itself or through a wrapper, and
+	// never leaves it is a lock wrapper returning with the lock held; one
+	// that only leaves it is an unlock wrapper.
+	may_sleep_.reset();
+	may_sleep_.resize(nr_sccs);
+	BitVector acquires(nr_sccs), releases(nr_sccs);
+	for (unsigned s = 0; s < nr_sccs; ++s) {
+		bool enter = false, exit = false;
+		for (unsigned i : members[s]) {
+			if (has_sleep.test(i))
+				may_sleep_.set(s);
+			enter |= has_entry.test(i);
+			exit |= has_exit.test(i);
+			for (unsigned j : G.callees(i)) {
+				unsigned t = scc_of[j];
+				if (may_sleep_.test(t))
+					may_sleep_.set(s);
+				if (t == s)
+					continue;
+				if (acquires.test(t)) {
+					has_entry.set(i);
+					enter = true;
+				}
+				exit |= releases.test(t);
+			}
+		}
+		if (enter && !exit)
+			acquires.set(s);
+		if (exit && !enter)
+			releases.set(s);
+	}
+
+	// Callers come first when walking backwards; callers of lock
+	// wrappers count as entries
+	in_atomic_.reset();
+	in_atomic_.resize(nr_sccs);
+	for (unsigned s = nr_sccs; s-- > 0; ) {
+		for (unsigned i : members[s])
+			if (has_entry.test(i))
+				in_atomic_.set(s);
+		if (!in_atomic_.test(s))
+			continue;
+		for (unsigned i : members[s])
+			for (unsigned j : G.callees(i))
+				in_atomic_.set(scc_of[j]);
+	}
+
+	in_slice = in_atomic_;
+	in_slice &= may_sleep_;
+}
+
+unsigned SensitiveSlice::size() const {
+	unsigned n = 0;
+	for (unsigned i = 0; i < scc_of.size(); ++i)
+		if (in_slice.test(scc_of[i]))
+			++n;
+	return n;
+}
+
+void SensitiveSlice::memory(mem::Snapshot &S) const {
+	mem::Usage U = mem::of(scc_of);
+	U.bytes += (may_sleep_.size() + in_atomic_.size() + in_slice.size()) / 8;
+	if (owned)
+		owned->memory(S);
+	S.add("slice", U);
+}
+
+bool SensitiveSlice::write(const std::string &file) const {
+	std::vector<StringRef> names;
+	for (unsigned i = 0; i < scc_of.size(); ++i)
+		if (in_slice.test(scc_of[i]) && !graph->function(i)->empty())
+			names.push_back(getFunctionName(graph->function(i)));
+	return writeFunctionList(file, names);
+}
+
+void addDefaultAtomicEntries(StringSet<> &names) {
+	names.insert("local_irq_save");
+	names.insert("local_irq_disable");
+	names.insert("preempt_disable");
+	names.insert("raw_spin_lock");
+	names.insert("raw_spin_lock_irq");
+	names.insert("raw_spin_lock_irqsave");
+}
+
+void addDefaultSleepingPrimitives(StringSet<> &names) {
+	names.insert("might_sleep");
+	names.insert("schedule");
+	names.insert("schedule_timeout");
+	names.insert("msleep");
+	names.insert("mutex_lock");
+	names.insert("down");
+	names.insert("wait_for_completion");
+	// spinlock_t and rwlock_t are sleeping locks on PREEMPT_RT
+	names.insert("spin_lock");
+	names.insert("spin_lock_bh");
+	names.insert("spin_lock_irq");
+	names.insert("spin_lock_irqsave");
+	names.insert("rt_spin_lock");
+	names.insert("read_lock");
+	names.insert("write_lock");
+}
+
+};
@@ -0,0 +1,105 @@
+#include "Stats.h"
+
+#include <map>
+#include <mutex>
+
+#include <llvm/Support/Format.h>
+
+using namespace llvm;
+
+namespace rsc {
+namespace stats {
+
+// std::map keeps the dump sorted, so two dumps diff cleanly
+static std::mutex lock;
+static std::map<std::string, uint64_t> counters;
+static std::map<std::string, std::map<unsigned, uint64_t>> histograms;
+static std::map<std::string, double> times;
+
+static unsigned bucket(uint64_t value) {
+	unsigned b = 0;
+	while (value) {
+		value >>= 1;
+		++b;
+	}
+	return b;
+}
+
+void add(StringRef counter, uint64_t n) {
+	std::lock_guard<std::mutex> g(lock);
+	counters[counter.str()] += n;
+}
+
+void declare(StringRef counter) {
+	add(counter, 0);
+}
+
+uint64_t get(StringRef counter) {
+	std::lock_guard<std::mutex> g(lock);
+	auto it = counters.find(counter.str());
+	return it == counters.end() ? 0 : it->second;
+}
+
+void sample(StringRef histogram, uint64_t value) {
+	std::lock_guard<std::mutex> g(lock);
+	++histograms[histogram.str()][bucket(value)];
+}
+
+void add_time(StringRef stage, double seconds) {
+	std::lock_guard<std::mutex> g(lock);
+	times[stage.str()] += seconds;
+}
+
+void reset() {
+	std::lock_guard<std::mutex> g(lock);
+	counters.clear();
+	histograms.clear();
+	times.clear();
+}
+
+static void print_bucket(raw_ostream &OS, unsigned b) {
+	if (b <= 1) {
+		OS << b;
+		return;
+	}
+	uint64_t lo = 1ULL << (b - 1);
+	OS << lo << "-" << (lo * 2 - 1);
+}
+
+void print_json(raw_ostream &OS) {
+	std::lock_guard<std::mutex> g(lock);
+	const char *sep;
+
+	OS << "{\n  \"counters\": {";
+	sep = "\n";
+	for (auto &c : counters) {
+		OS << sep << "    \"" << c.first << "\": " << c.second;
+		sep = ",\n";
+	}
+	OS << "\n  },\n  \"histograms\": {";
+	sep = "\n";
+	for (auto &h : histograms) {
+		OS << sep << "    \"" << h.first << "\": {";
+		const char *bsep = "";
+		for (auto &b : h.second) {
+			OS << bsep << "\"";
+			print_bucket(OS, b.first);
+			OS << "\": " << b.second;
+			bsep = ", ";
+		}
+		OS << "}";
+		sep = ",\n";
+	}
+	OS << "\n  },\n  \"times\": {";
+	sep = "\n";
+	for (auto &t : times) {
+		OS << sep << "    \"" << t.first << "\": ";
+		OS << format("%.6f", t.second);
+		sep = ",\n";
+	}
+	OS << "\n  }\n}\n";
+	OS.flush();
+}
+
+};
+};
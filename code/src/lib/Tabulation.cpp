@@ -0,0 +1,616 @@
+#include "Tabulation.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/IR/Function.h>
+
+#include "util.h"
+
+using namespace llvm;
+
+namespace rsc {
+
+namespace atomic {
+
+Fact apply(Fact d, unsigned effects) {
+	unsigned irq = d & IRQ_OFF, lock = d & RAW_LOCK, n = depth(d);
+
+	if (effects & E_IRQ_OFF)
+		irq = IRQ_OFF;
+	if (effects & E_IRQ_ON)
+		irq = 0;
+	if (effects & (E_PREEMPT_OFF | E_LOCK))
+		n = std::min<unsigned>(n + 1, MAX_DEPTH);
+	if ((effects & (E_PREEMPT_ON | E_UNLOCK)) && n > 0 && n < MAX_DEPTH)
+		--n;
+	if (effects & E_LOCK)
+		lock = RAW_LOCK;
+	if (effects & E_UNLOCK)
+		lock = 0;
+
+	return irq | lock | (n << DEPTH_SHIFT);
+}
+
+static StringMap<unsigned> make_effect_table() {
+	StringMap<unsigned> table;
+	table["local_irq_disable"] = E_IRQ_OFF;
+	table["local_irq_save"] = E_IRQ_OFF;
+	table["local_irq_enable"] = E_IRQ_ON;
+	table["local_irq_restore"] = E_IRQ_ON;
+	table["preempt_disable"] = E_PREEMPT_OFF;
+	table["preempt_enable"] = E_PREEMPT_ON;
+	table["preempt_enable_no_resched"] = E_PREEMPT_ON;
+	table["raw_spin_lock"] = E_LOCK;
+	table["raw_spin_lock_irq"] = E_LOCK | E_IRQ_OFF;
+	table["raw_spin_lock_irqsave"] = E_LOCK | E_IRQ_OFF;
+	table["raw_spin_unlock"] = E_UNLOCK;
+	table["raw_spin_unlock_irq"] = E_UNLOCK | E_IRQ_ON;
+	table["raw_spin_unlock_irqrestore"] = E_UNLOCK | E_IRQ_ON;
+	return table;
+}
+
+unsigned effect_of(StringRef name) {
+	static const StringMap<unsigned> table = make_effect_table();
+	StringMap<unsigned>::const_iterator it = table.find(name);
+	return it == table.end() ? 0 : it->second;
+}
+
+std::string to_string(Fact d) {
+	std::string s;
+	if (d & IRQ_OFF)
+		s += "irq-off,";
+	if (depth(d))
+		s += "preempt-off(" + std::to_string(depth(d)) + "),";
+	if (d & RAW_LOCK)
+		s += "raw-lock,";
+	if (s.empty())
+		return "none";
+	s.pop_back();
+	return s;
+}
+
+};
+
+AtomicTabulation::AtomicTabulation(Skeletons &S)
+	: skeletons(S), graph(S.call_graph()), iterations(0), summary_cap(0) {
+	degraded_.resize(graph.nr_functions());
+}
+
+void AtomicTabulation::propagate(FuncId f, Fact entry, unsigned point, Fact d) {
+	uint64_t k = ((uint64_t)f << 32) | (point << 8) | (entry << 4) | d;
+	if (!path_edges.insert(k).second)
+		return;
+	PathEdge e = { f, entry, point, d };
+	worklist.push_back(e);
+}
+
+void AtomicTabulation::add_exit(FuncId f, Fact entry, Fact d) {
+	unsigned &mask = end_summary[key(f, entry)];
+	if (mask & (1U << d))
+		return;
+	mask |= 1U << d;
+
+	// resume every caller waiting on this summary
+	auto it = incoming.find(key(f, entry));
+	if (it == incoming.end())
+		return;
+	for (const Caller &c : it->second)
+		propagate(c.func, c.entry, c.point, d);
+}
+
+/*
+ * Each sleeping call is kept per summary, for replaying it, and reported
+ * once per atomic state.
+ */
+void AtomicTabulation::reach_sleep(FuncId f, Fact entry, unsigned point,
+				   SiteId s, Fact d) {
+	uint64_t k = ((uint64_t)f << 32) | (point << 8) | (entry << 4) | d;
+	if (!sleep_edges.insert(k).second)
+		return;
+	Sleep S = { s, d, point };
+	sleeps_[key(f, entry)].push_back(S);
+
+	if (reported.insert((s << 4) | d).second) {
+		Report r = { s, d, f, entry, point };
+		reports_.push_back(r);
+	}
+}
+
+void AtomicTabulation::replay(FuncId f, Fact entry, const Summary &S) {
+	for (const CallEdge &E : S.calls) {
+		if (summary_cap)
+			entry_mask[E.callee] |= 1U << E.fact;
+		Caller c = { f, entry, E.point };
+		incoming[key(E.callee, E.fact)].push_back(c);
+		propagate(E.callee, E.fact, 0, E.fact);
+	}
+	for (const Sleep &s : S.sleeps)
+		reach_sleep(f, entry, s.point, s.site, s.fact);
+	for (unsigned x = 0; x < atomic::NR_FACTS; ++x)
+		if (S.exits & (1U << x))
+			add_exit(f, entry, x);
+}
+
+void AtomicTabulation::process(const PathEdge &e) {
+	const Body &B = body(e.func);
+	Fact d = e.fact;
+
+	for (unsigned i = e.point; ; ++i) {
+		const Event &ev = B.events[i];
+
+		switch (ev.kind) {
+		case Skeleton::EV_EFFECT:
+			d = atomic::apply(d, ev.arg);
+			break;
+
+		case Skeleton::EV_SLEEP:
+			if (atomic::in_atomic(d))
+				reach_sleep(e.func, e.entry, i, ev.arg, d);
+			break;
+
+		case Skeleton::EV_CALL: {
+			// targets are alternatives, primitives among them included
+			bool skips = false;
+			for (FuncId t : graph.targets(ev.arg)) {
+				if (skeletons.sleeps(t)) {
+					if (atomic::in_atomic(d))
+						reach_sleep(e.func, e.entry, i, ev.arg, d);
+					skips = true;
+					continue;
+				}
+				if (unsigned effect = skeletons.effect(t)) {
+					propagate(e.func, e.entry, i + 1, atomic::apply(d, effect));
+					continue;
+				}
+				if (!has_body(t)) {
+					skips = true;
+					continue;
+				}
+				Fact w = widen(t, d);
+				Caller c = { e.func, e.entry, i + 1 };
+				incoming[key(t, w)].push_back(c);
+				propagate(t, w, 0, w);
+
+				auto it = end_summary.find(key(t, w));
+				if (it == end_summary.end())
+					continue;
+				for (unsigned x = 0; x < atomic::NR_FACTS; ++x)
+					if (it->second & (1U << x))
+						propagate(e.func, e.entry, i + 1, x);
+			}
+			// external callees leave the state unchanged
+			if (skips)
+				propagate(e.func, e.entry, i + 1, d);
+			return;
+		}
+
+		case Skeleton::EV_END: {
+			unsigned b = ev.arg;
+			if (B.is_exit[b])
+				add_exit(e.func, e.entry, d);
+			for (unsigned j = B.succ_off[b]; j < B.succ_off[b + 1]; ++j)
+				propagate(e.func, e.entry, B.block_begin[B.succ_tgt[j]], d);
+			return;
+		}
+		}
+	}
+}
+
+/*
+ * A degraded function has one point, holding every fact that may hold
+ * anywhere in it for an entry. Each new fact is pushed through all events
+ * regardless of the CFG; edges still arriving at real points, from callers
+ * or returning callees, are folded into it.
+ */
+void AtomicTabulation::process_degraded(const PathEdge &e) {
+	if (e.point != DEGRADED_POINT) {
+		propagate(e.func, e.entry, DEGRADED_POINT, e.fact);
+		return;
+	}
+
+	const Body &B = body(e.func);
+	Fact d = e.fact;
+	DenseSet<FuncId> entered;
+
+	for (unsigned i = 0; i < B.events.size(); ++i) {
+		const Event &ev = B.events[i];
+
+		switch (ev.kind) {
+		case Skeleton::EV_EFFECT:
+			propagate(e.func, e.entry, DEGRADED_POINT, atomic::apply(d, ev.arg));
+			break;
+
+		case Skeleton::EV_SLEEP:
+			if (atomic::in_atomic(d))
+				reach_sleep(e.func, e.entry, i, ev.arg, d);
+			break;
+
+		case Skeleton::EV_CALL:
+			for (FuncId t : graph.targets(ev.arg)) {
+				if (skeletons.sleeps(t)) {
+					if (atomic::in_atomic(d))
+						reach_sleep(e.func, e.entry, i, ev.arg, d);
+					continue;
+				}
+				if (unsigned effect = skeletons.effect(t)) {
+					propagate(e.func, e.entry, DEGRADED_POINT,
+						  atomic::apply(d, effect));
+					continue;
+				}
+				if (!has_body(t) || !entered.insert(t).second)
+					continue;
+				Fact w = widen(t, d);
+				Caller c = { e.func, e.entry, DEGRADED_POINT };
+				incoming[key(t, w)].push_back(c);
+				propagate(t, w, 0, w);
+
+				unsigned mask = exits(t, w);
+				for (unsigned x = 0; x < atomic::NR_FACTS; ++x)
+					if (mask & (1U << x))
+						propagate(e.func, e.entry, DEGRADED_POINT, x);
+			}
+			break;
+
+		case Skeleton::EV_END:
+			if (B.is_exit[ev.arg])
+				add_exit(e.func, e.entry, d);
+			break;
+		}
+	}
+}
+
+void AtomicTabulation::degrade(FuncId f, Exhausted reason) {
+	if (degraded_.test(f))
+		return;
+	degraded_.set(f);
+	Degraded D = { f, reason };
+	degraded_list.push_back(D);
+
+	// restart every entry reached so far from the single point
+	unsigned mask = entries(f);
+	for (unsigned d = 0; d < atomic::NR_FACTS; ++d)
+		if (mask & (1U << d))
+			propagate(f, d, DEGRADED_POINT, d);
+}
+
+void AtomicTabulation::charge(FuncId f, double elapsed) {
+	++steps[f];
+	seconds[f] += elapsed;
+	if (budget.steps && steps[f] > budget.steps)
+		degrade(f, OUT_OF_STEPS);
+	else if (budget.seconds > 0 && seconds[f] > budget.seconds)
+		degrade(f, OUT_OF_TIME);
+}
+
+void AtomicTabulation::set_budget(const Budget &B) {
+	budget = B;
+	if (budget.empty())
+		return;
+	steps.assign(graph.nr_functions(), 0);
+	seconds.assign(graph.nr_functions(), 0);
+}
+
+void AtomicTabulation::set_summary_cap(unsigned cap) {
+	summary_cap = cap;
+	entry_mask.assign(cap ? graph.nr_functions() : 0, 0);
+}
+
+/*
+ * The entry fact under which a call entering f in d is summarized: d
+ * itself while f has fewer than summary_cap summaries, then the most
+ * precise summary covering d, and failing that a new one covering d and
+ * all the others.
+ */
+atomic::Fact AtomicTabulation::widen(FuncId f, Fact d) {
+	if (!summary_cap)
+		return d;
+	auto it = widened.find(key(f, d));
+	if (it != widened.end())
+		return it->second;
+
+	unsigned mask = entry_mask[f];
+	if ((mask & (1U << d)) || countPopulation(mask) < summary_cap) {
+		entry_mask[f] |= 1U << d;
+		return d;
+	}
+
+	unsigned w = atomic::NR_FACTS;
+	for (unsigned e = 0; e < atomic::NR_FACTS; ++e)
+		if ((mask & (1U << e)) && atomic::covers(e, d) &&
+		    (w == atomic::NR_FACTS || atomic::covers(w, e)))
+			w = e;
+	if (w == atomic::NR_FACTS) {
+		w = d;
+		for (unsigned e = 0; e < atomic::NR_FACTS; ++e)
+			if (mask & (1U << e))
+				w = atomic::join(w, e);
+	}
+
+	entry_mask[f] |= 1U << w;
+	widened[key(f, d)] = w;
+	return w;
+}
+
+atomic::Fact AtomicTabulation::entry_of(FuncId f, Fact d) const {
+	auto it = widened.find(key(f, d));
+	return it == widened.end() ? d : it->second;
+}
+
+void AtomicTabulation::add_entry(FuncId f, Fact d) {
+	if (!has_body(f))
+		return;
+	if (summary_cap)
+		entry_mask[f] |= 1U << d;
+	roots.insert(key(f, d));
+	propagate(f, d, 0, d);
+}
+
+void AtomicTabulation::solve() {
+	while (!worklist.empty()) {
+		PathEdge e = worklist.back();
+		worklist.pop_back();
+		++iterations;
+
+		// a restored summary is replayed once entered, never explored
+		if (!restored.empty()) {
+			auto it = restored.find(key(e.func, e.entry));
+			if (it != restored.end()) {
+				if (e.point == 0 && e.fact == e.entry)
+					replay(e.func, e.entry, it->second);
+				continue;
+			}
+		}
+
+		if (degraded_.test(e.func)) {
+			process_degraded(e);
+			continue;
+		}
+		if (budget.empty()) {
+			process(e);
+			continue;
+		}
+
+		// clock reads only when time is limited
+		if (budget.seconds > 0) {
+			auto begin = std::chrono::steady_clock::now();
+			process(e);
+			std::chrono::duration<double> d =
+				std::chrono::steady_clock::now() - begin;
+			charge(e.func, d.count());
+		} else {
+			process(e);
+			charge(e.func, 0);
+		}
+	}
+}
+
+unsigned AtomicTabulation::exits(FuncId f, Fact d) const {
+	auto it = end_summary.find(key(f, d));
+	return it == end_summary.end() ? 0 : it->second;
+}
+
+unsigned AtomicTabulation::block_of(const Body &B, unsigned point) const {
+	return std::upper_bound(B.block_begin.begin(), B.block_begin.end(), point)
+		- B.block_begin.begin() - 1;
+}
+
+/*
+ * Shortest path inside f from its entry in state entry to the event target
+ * in state fact. Nodes are (point, state) pairs, where a point is a block
+ * start or a return point; calls step over the callee summaries.
+ */
+bool AtomicTabulation::rebuild_path(FuncId f, Fact entry, unsigned target,
+				    Fact fact, std::vector<unsigned> &blocks) {
+	const Body &B = body(f);
+	DenseMap<unsigned, unsigned> parent;                 // node -> node
+	std::vector<unsigned> queue;
+	unsigned start = entry, found = ~0U;
+
+	parent[start] = start;
+	queue.push_back(start);
+	for (unsigned q = 0; q < queue.size() && found == ~0U; ++q) {
+		unsigned node = queue[q];
+		Fact d = node & (atomic::NR_FACTS - 1);
+		std::vector<unsigned> next;
+
+		for (unsigned i = node >> 4; ; ++i) {
+			const Event &ev = B.events[i];
+			if (i == target && d == fact) {
+				found = node;
+				break;
+			}
+			if (ev.kind == Skeleton::EV_EFFECT) {
+				d = atomic::apply(d, ev.arg);
+			} else if (ev.kind == Skeleton::EV_CALL) {
+				bool skips = false;
+				for (FuncId t : graph.targets(ev.arg)) {
+					if (unsigned effect = skeletons.effect(t)) {
+						next.push_back(((i + 1) << 4) |
+							       atomic::apply(d, effect));
+						continue;
+					}
+					if (skeletons.sleeps(t) || !has_body(t)) {
+						skips = true;
+						continue;
+					}
+					unsigned mask = exits(t, entry_of(t, d));
+					for (unsigned x = 0; x < atomic::NR_FACTS; ++x)
+						if (mask & (1U << x))
+							next.push_back(((i + 1) << 4) | x);
+				}
+				if (skips)
+					next.push_back(((i + 1) << 4) | d);
+				break;
+			} else if (ev.kind == Skeleton::EV_END) {
+				for (unsigned j = B.succ_off[ev.arg]; j < B.succ_off[ev.arg + 1]; ++j)
+					next.push_back((B.block_begin[B.succ_tgt[j]] << 4) | d);
+				break;
+			}
+		}
+
+		for (unsigned n : next)
+			if (parent.insert(std::make_pair(n, node)).second)
+				queue.push_back(n);
+	}
+
+	if (found == ~0U)
+		return false;
+
+	// walk back to the entry, recording each block once
+	blocks.clear();
+	blocks.push_back(block_of(B, target));
+	for (unsigned node = found; ; node = parent[node]) {
+		unsigned b = block_of(B, node >> 4);
+		if (b != blocks.back())
+			blocks.push_back(b);
+		if (node == start)
+			break;
+	}
+	std::reverse(blocks.begin(), blocks.end());
+	return true;
+}
+
+/*
+ * The chain from an entry down to the event point of f entered in state
+ * entry, where the state is fact. With point == ~0U, f itself is left out.
+ */
+bool AtomicTabulation::build_chain(FuncId f, Fact entry, unsigned point,
+				   Fact fact, std::vector<Step> &chain) {
+	// BFS from the summary up the incoming caller edges
+	DenseMap<unsigned, std::pair<unsigned, unsigned>> down; // node -> callee, point
+	std::vector<unsigned> queue;
+	unsigned start = key(f, entry), root = ~0U;
+
+	down[start] = std::make_pair(~0U, point);
+	queue.push_back(start);
+	for (unsigned q = 0; q < queue.size(); ++q) {
+		unsigned node = queue[q];
+		if (roots.count(node)) {
+			root = node;
+			break;
+		}
+		auto it = incoming.find(node);
+		if (it == incoming.end())
+			continue;
+		for (const Caller &c : it->second) {
+			// a degraded caller has no path to rebuild
+			if (c.point == DEGRADED_POINT)
+				continue;
+			unsigned n = key(c.func, c.entry);
+			if (down.insert(std::make_pair(n, std::make_pair(node, c.point - 1))).second)
+				queue.push_back(n);
+		}
+	}
+
+	if (root == ~0U)
+		return false;
+
+	// walk down to the report, rebuilding the path in each function
+	chain.clear();
+	for (unsigned node = root; node != ~0U; ) {
+		unsigned callee = down[node].first, at = down[node].second;
+		if (at == ~0U)
+			break;
+		Step S;
+		S.func = node >> 4;
+		S.entry = node & (atomic::NR_FACTS - 1);
+		S.site = body(S.func).events[at].arg;
+
+		// the call may have entered a summary widened from its fact
+		bool found = false;
+		for (unsigned x = 0; x < atomic::NR_FACTS && !found; ++x) {
+			if (callee == ~0U ? x != fact :
+			    entry_of(callee >> 4, x) != (callee & (atomic::NR_FACTS - 1)))
+				continue;
+			S.fact = x;
+			found = rebuild_path(S.func, S.entry, at, S.fact, S.blocks);
+		}
+		if (!found)
+			return false;
+		chain.push_back(S);
+		node = callee;
+	}
+	return true;
+}
+
+bool AtomicTabulation::witness(const Report &R, std::vector<Step> &chain) {
+	return build_chain(R.func, R.entry, R.point, R.fact, chain);
+}
+
+bool AtomicTabulation::chain_to(FuncId f, Fact d, std::vector<Step> &chain) {
+	return build_chain(f, d, ~0U, d, chain);
+}
+
+unsigned AtomicTabulation::entries(FuncId f) const {
+	unsigned mask = 0;
+	for (unsigned d = 0; d < atomic::NR_FACTS; ++d) {
+		uint64_t k = ((uint64_t)f << 32) | (d << 4) | d;
+		if (path_edges.count(k))
+			mask |= 1U << d;
+	}
+	return mask;
+}
+
+void AtomicTabulation::add_summary(FuncId f, Fact d, const Summary &S) {
+	restored[key(f, d)] = S;
+}
+
+const std::vector<AtomicTabulation::Sleep> &
+AtomicTabulation::sleeps(FuncId f, Fact d) const {
+	static const std::vector<Sleep> none;
+	auto it = sleeps_.find(key(f, d));
+	return it == sleeps_.end() ? none : it->second;
+}
+
+void AtomicTabulation::callers(std::vector<CallEdge> &edges) const {
+	for (auto &entry : incoming) {
+		for (const Caller &c : entry.second) {
+			CallEdge E = { entry.first >> 4,
+				       (Fact)(entry.first & (atomic::NR_FACTS - 1)),
+				       c.func, c.entry, c.point };
+			edges.push_back(E);
+		}
+	}
+}
+
+void AtomicTabulation::memory(mem::Snapshot &S) const {
+	S.add("tabulation.path_edges",
+	      mem::Usage(path_edges.size(), mem::of(path_edges).bytes +
+			 mem::of(worklist).bytes));
+	S.add("tabulation.summaries", mem::of(end_summary));
+
+	mem::Usage C(0, mem::of(incoming).bytes);
+	for (auto &I : incoming) {
+		C.entries += I.second.size();
+		C.bytes += mem::of(I.second).bytes;
+	}
+	S.add("tabulation.callers", C);
+
+	S.add("tabulation.reports",
+	      mem::Usage(reports_.size(), mem::of(reports_).bytes +
+			 mem::of(reported).bytes + mem::of(roots).bytes));
+
+	mem::Usage L(sleep_edges.size(), mem::of(sleep_edges).bytes +
+		     mem::of(sleeps_).bytes);
+	for (auto &I : sleeps_)
+		L.bytes += mem::of(I.second).bytes;
+	S.add("tabulation.sleeps", L);
+
+	mem::Usage R(restored.size(), mem::of(restored).bytes);
+	for (auto &I : restored)
+		R.bytes += mem::of(I.second.calls).bytes + mem::of(I.second.sleeps).bytes;
+	S.add("tabulation.restored", R);
+	S.add("tabulation.widened",
+	      mem::Usage(widened.size(), mem::of(widened).bytes +
+			 mem::of(entry_mask).bytes));
+	S.add("tabulation.budget",
+	      mem::Usage(degraded_list.size(), mem::of(steps).bytes +
+			 mem::of(seconds).bytes + degraded_.getMemorySize() +
+			 mem::of(degraded_list).bytes));
+}
+
+};
@@ -0,0 +1,146 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+namespace rsc {
+namespace trace {
+
+bool enabled = false;
+
+namespace {
+
+struct Event {
+	std::string name;
+	Category cat;
+	uint64_t begin, end;
+};
+
+struct Buffer {
+	unsigned tid;
+	std::vector<Event> events;
+};
+
+std::mutex lock;                        // guards the list of buffers only
+std::vector<std::unique_ptr<Buffer>> buffers;
+std::string output;
+std::chrono::steady_clock::time_point epoch;
+
+thread_local Buffer *local = NULL;
+
+Buffer &buffer() {
+	if (!local) {
+		std::lock_guard<std::mutex> g(lock);
+		buffers.emplace_back(new Buffer());
+		local = buffers.back().get();
+		local->tid = buffers.size();
+	}
+	return *local;
+}
+
+const char *category_name(Category cat) {
+	switch (cat) {
+	case STAGE:    return "stage";
+	case MODULE:   return "module";
+	case SCC:      return "scc";
+	case FUNCTION: return "function";
+	}
+	return "";
+}
+
+void write_string(raw_ostream &OS, StringRef s) {
+	OS << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			OS << '\\' << c;
+		else if ((unsigned char)c < 0x20)
+			OS << ' ';
+		else
+			OS << c;
+	}
+	OS << '"';
+}
+
+void finish_at_exit() {
+	finish();
+}
+
+}
+
+bool start(const std::string &file) {
+	// fail early rather than after the whole run
+	std::error_code EC;
+	raw_fd_ostream OS(file, EC, sys::fs::F_None);
+	if (EC)
+		return false;
+
+	static bool registered = false;
+	if (!registered) {
+		std::atexit(finish_at_exit);
+		registered = true;
+	}
+
+	output = file;
+	epoch = std::chrono::steady_clock::now();
+	enabled = true;
+	return true;
+}
+
+uint64_t now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(StringRef name, Category cat, uint64_t begin, uint64_t end) {
+	Buffer &B = buffer();
+	B.events.push_back(Event());
+	Event &E = B.events.back();
+	E.name = name.str();
+	E.cat = cat;
+	E.begin = begin;
+	E.end = end;
+}
+
+void finish() {
+	if (!enabled)
+		return;
+	enabled = false;
+
+	std::error_code EC;
+	raw_fd_ostream OS(output, EC, sys::fs::F_None);
+	if (EC) {
+		errs() << "Cannot write trace " << output << "\n";
+		return;
+	}
+
+	std::lock_guard<std::mutex> g(lock);
+	OS << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	const char *sep = "";
+	for (auto &B : buffers) {
+		OS << sep << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+		   << "\"tid\": " << B->tid << ", \"args\": {\"name\": \"thread "
+		   << B->tid << "\"}}";
+		sep = ",\n";
+		for (Event &E : B->events) {
+			OS << sep << "{\"ph\": \"X\", \"name\": ";
+			write_string(OS, E.name);
+			OS << ", \"cat\": \"" << category_name(E.cat)
+			   << "\", \"pid\": 1, \"tid\": " << B->tid
+			   << ", \"ts\": " << E.begin
+			   << ", \"dur\": " << E.end - E.begin << "}";
+		}
+		B->events.clear();
+	}
+	OS << "\n]}\n";
+}
+
+};
+};
@@ -0,0 +1,52 @@
+#include "TrivialLeaf.h"
+
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+
+#include "Tabulation.h"
+#include "util.h"
+
+using namespace llvm;
+
+namespace rsc {
+
+bool isTrivialLeaf(const Function &F) {
+	if (F.empty())
+		return false;
+
+	for (const_inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i) {
+		if (isa<InvokeInst>(&*i))
+			return false;
+		const CallInst *CI = dyn_cast<CallInst>(&*i);
+		if (!CI)
+			continue;
+		if (CI->isInlineAsm())
+			return false;
+		const Function *Callee = CI->getCalledFunction();
+		if (!Callee || !Callee->isIntrinsic())
+			return false;
+	}
+	return true;
+}
+
+void TrivialLeaves::compute(const CallGraphCSR &G, const StringSet<> &inlined,
+			    const StringSet<> &sleepers) {
+	graph = &G;
+	leaf.reset();
+	leaf.resize(G.nr_functions());
+
+	for (unsigned f = 0; f < G.nr_functions(); ++f) {
+		Function *F = G.function(f);
+		StringRef name = getFunctionName(F);
+		if (inlined.count(name)) {
+			leaf.set(f);
+			continue;
+		}
+		if (sleepers.count(name) || atomic::effect_of(name))
+			continue;
+		if (isTrivialLeaf(*F))
+			leaf.set(f);
+	}
+}
+
+};
@@ -4,7 +4,11 @@
 #include <sstream>
 #include <list>
 
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Metadata.h>
@@ -19,4 +23,277 @@ StringRef getFunctionName(Function *F) {
 	return F->getName();
 }
 
-}; //end of namespace rsc
\ No newline at end of file
+bool readFunctionList(const std::string &file, StringSet<> &names) {
+	std::ifstream fin(file);
+	if (!fin.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(fin, line)) {
+		StringRef name = StringRef(line).trim();
+		if (!name.empty())
+			names.insert(name);
+	}
+	return true;
+}
+
+bool writeFunctionList(const std::string &file,
+		       const std::vector<StringRef> &names) {
+	std::ofstream fout(file, std::ios::trunc);
+	if (!fout.is_open())
+		return false;
+
+	for (StringRef name : names)
+		fout << name.str() << "\n";
+	return fout.good();
+}
+
+namespace {
+
+/*
+ * Arguments, blocks and instructions are matched by their position in the
+ * function, debug intrinsics left out; globals by name.
+ */
+class BodyComparator {
+	DenseMap<const Value*, unsigned> left, right;
+	DenseSet<std::pair<Type*, Type*>> assumed;      // structs being compared
+
+	static void number(Function *F, DenseMap<const Value*, unsigned> &ids) {
+		unsigned n = 0;
+		for (Argument &A : F->args())
+			ids[&A] = ++n;
+		for (BasicBlock &BB : *F)
+			ids[&BB] = ++n;
+		for (BasicBlock &BB : *F)
+			for (Instruction &I : BB)
+				if (!isa<DbgInfoIntrinsic>(&I))
+					ids[&I] = ++n;
+	}
+
+	bool same(Type *A, Type *B);
+	bool same(Value *A, Value *B);
+	bool same(Instruction *A, Instruction *B);
+
+	template <typename CallT>
+	static bool same_call(CallT *A, CallT *B) {
+		return A->getCallingConv() == B->getCallingConv() &&
+			A->getAttributes() == B->getAttributes();
+	}
+
+public:
+	bool same(Function *A, Function *B);
+};
+
+bool BodyComparator::same(Type *A, Type *B) {
+	if (A == B)
+		return true;
+	if (A->getTypeID() != B->getTypeID() ||
+	    A->getNumContainedTypes() != B->getNumContainedTypes())
+		return false;
+
+	if (StructType *SA = dyn_cast<StructType>(A)) {
+		StructType *SB = cast<StructType>(B);
+		// a forward declaration has nothing to compare but its name
+		if (SA->isOpaque() || SB->isOpaque())
+			return SA->isOpaque() && SB->isOpaque();
+		if (SA->isPacked() != SB->isPacked())
+			return false;
+		// a recursive struct is equal unless some other field differs
+		if (!assumed.insert(std::make_pair(A, B)).second)
+			return true;
+	} else if (A->isIntegerTy()) {
+		if (A->getIntegerBitWidth() != B->getIntegerBitWidth())
+			return false;
+	} else if (A->isArrayTy()) {
+		if (A->getArrayNumElements() != B->getArrayNumElements())
+			return false;
+	} else if (A->isVectorTy()) {
+		if (A->getPrimitiveSizeInBits() != B->getPrimitiveSizeInBits())
+			return false;
+	} else if (A->isPointerTy()) {
+		if (A->getPointerAddressSpace() != B->getPointerAddressSpace())
+			return false;
+	} else if (A->isFunctionTy()) {
+		if (cast<FunctionType>(A)->isVarArg() != cast<FunctionType>(B)->isVarArg())
+			return false;
+	}
+
+	for (unsigned i = 0; i < A->getNumContainedTypes(); ++i)
+		if (!same(A->getContainedType(i), B->getContainedType(i)))
+			return false;
+	return true;
+}
+
+bool BodyComparator::same(Value *A, Value *B) {
+	if (A == B)
+		return true;
+	if (A->getValueID() != B->getValueID() || !same(A->getType(), B->getType()))
+		return false;
+
+	auto l = left.find(A), r = right.find(B);
+	if (l != left.end() || r != right.end())
+		return l != left.end() && r != right.end() && l->second == r->second;
+
+	if (GlobalValue *GA = dyn_cast<GlobalValue>(A))
+		return GA->getName() == cast<GlobalValue>(B)->getName();
+	if (ConstantInt *CA = dyn_cast<ConstantInt>(A))
+		return CA->getValue() == cast<ConstantInt>(B)->getValue();
+	if (ConstantFP *CA = dyn_cast<ConstantFP>(A))
+		return CA->getValueAPF().bitwiseIsEqual(cast<ConstantFP>(B)->getValueAPF());
+	if (ConstantDataSequential *CA = dyn_cast<ConstantDataSequential>(A))
+		return CA->getRawDataValues() ==
+			cast<ConstantDataSequential>(B)->getRawDataValues();
+	if (isa<ConstantPointerNull>(A) || isa<UndefValue>(A) ||
+	    isa<ConstantAggregateZero>(A))
+		return true;
+	if (InlineAsm *IA = dyn_cast<InlineAsm>(A)) {
+		InlineAsm *IB = cast<InlineAsm>(B);
+		return IA->getAsmString() == IB->getAsmString() &&
+			IA->getConstraintString() == IB->getConstraintString() &&
+			IA->hasSideEffects() == IB->hasSideEffects() &&
+			IA->isAlignStack() == IB->isAlignStack() &&
+			IA->getDialect() == IB->getDialect();
+	}
+	if (MetadataAsValue *MA = dyn_cast<MetadataAsValue>(A))
+		return MA->getMetadata() == cast<MetadataAsValue>(B)->getMetadata();
+
+	if (ConstantExpr *CA = dyn_cast<ConstantExpr>(A)) {
+		ConstantExpr *CB = cast<ConstantExpr>(B);
+		if (CA->getOpcode() != CB->getOpcode())
+			return false;
+		if (CA->isCompare() && CA->getPredicate() != CB->getPredicate())
+			return false;
+		if (GEPOperator *GA = dyn_cast<GEPOperator>(CA)) {
+			GEPOperator *GB = cast<GEPOperator>(CB);
+			if (GA->isInBounds() != GB->isInBounds() ||
+			    !same(GA->getSourceElementType(), GB->getSourceElementType()))
+				return false;
+		}
+	} else if (!isa<ConstantAggregate>(A)) {
+		// block addresses and the like
+		return false;
+	}
+
+	User *UA = cast<User>(A), *UB = cast<User>(B);
+	if (UA->getNumOperands() != UB->getNumOperands())
+		return false;
+	for (unsigned i = 0; i < UA->getNumOperands(); ++i)
+		if (!same(UA->getOperand(i), UB->getOperand(i)))
+			return false;
+	return true;
+}
+
+bool BodyComparator::same(Instruction *A, Instruction *B) {
+	if (A->getOpcode() != B->getOpcode() ||
+	    A->getNumOperands() != B->getNumOperands() ||
+	    A->getRawSubclassOptionalData() != B->getRawSubclassOptionalData() ||
+	    !same(A->getType(), B->getType()))
+		return false;
+	for (unsigned i = 0; i < A->getNumOperands(); ++i)
+		if (!same(A->getOperand(i), B->getOperand(i)))
+			return false;
+
+	// what is not an operand
+	if (CmpInst *CA = dyn_cast<CmpInst>(A))
+		return CA->getPredicate() == cast<CmpInst>(B)->getPredicate();
+	if (LoadInst *LA = dyn_cast<LoadInst>(A)) {
+		LoadInst *LB = cast<LoadInst>(B);
+		return LA->isVolatile() == LB->isVolatile() &&
+			LA->getAlignment() == LB->getAlignment() &&
+			LA->getOrdering() == LB->getOrdering();
+	}
+	if (StoreInst *SA = dyn_cast<StoreInst>(A)) {
+		StoreInst *SB = cast<StoreInst>(B);
+		return SA->isVolatile() == SB->isVolatile() &&
+			SA->getAlignment() == SB->getAlignment() &&
+			SA->getOrdering() == SB->getOrdering();
+	}
+	if (AllocaInst *AA = dyn_cast<AllocaInst>(A)) {
+		AllocaInst *AB = cast<AllocaInst>(B);
+		return AA->getAlignment() == AB->getAlignment() &&
+			same(AA->getAllocatedType(), AB->getAllocatedType());
+	}
+	if (GetElementPtrInst *GA = dyn_cast<GetElementPtrInst>(A)) {
+		GetElementPtrInst *GB = cast<GetElementPtrInst>(B);
+		return GA->isInBounds() == GB->isInBounds() &&
+			same(GA->getSourceElementType(), GB->getSourceElementType());
+	}
+	if (CallInst *CA = dyn_cast<CallInst>(A)) {
+		CallInst *CB = cast<CallInst>(B);
+		return same_call(CA, CB) && CA->isTailCall() == CB->isTailCall() &&
+			same(CA->getFunctionType(), CB->getFunctionType());
+	}
+	if (InvokeInst *IA = dyn_cast<InvokeInst>(A))
+		return same_call(IA, cast<InvokeInst>(B));
+	if (PHINode *PA = dyn_cast<PHINode>(A)) {
+		PHINode *PB = cast<PHINode>(B);
+		for (unsigned i = 0; i < PA->getNumIncomingValues(); ++i)
+			if (!same(PA->getIncomingBlock(i), PB->getIncomingBlock(i)))
+				return false;
+		return true;
+	}
+	if (ExtractValueInst *EA = dyn_cast<ExtractValueInst>(A))
+		return EA->getIndices() == cast<ExtractValueInst>(B)->getIndices();
+	if (InsertValueInst *IA = dyn_cast<InsertValueInst>(A))
+		return IA->getIndices() == cast<InsertValueInst>(B)->getIndices();
+	if (ShuffleVectorInst *SA = dyn_cast<ShuffleVectorInst>(A)) {
+		SmallVector<int, 16> a, b;
+		SA->getShuffleMask(a);
+		cast<ShuffleVectorInst>(B)->getShuffleMask(b);
+		return a == b;
+	}
+	if (AtomicRMWInst *RA = dyn_cast<AtomicRMWInst>(A)) {
+		AtomicRMWInst *RB = cast<AtomicRMWInst>(B);
+		return RA->getOperation() == RB->getOperation() &&
+			RA->getOrdering() == RB->getOrdering() &&
+			RA->isVolatile() == RB->isVolatile();
+	}
+	if (AtomicCmpXchgInst *XA = dyn_cast<AtomicCmpXchgInst>(A)) {
+		AtomicCmpXchgInst *XB = cast<AtomicCmpXchgInst>(B);
+		return XA->getSuccessOrdering() == XB->getSuccessOrdering() &&
+			XA->getFailureOrdering() == XB->getFailureOrdering() &&
+			XA->isVolatile() == XB->isVolatile() &&
+			XA->isWeak() == XB->isWeak();
+	}
+	if (FenceInst *FA = dyn_cast<FenceInst>(A))
+		return FA->getOrdering() == cast<FenceInst>(B)->getOrdering();
+	return true;
+}
+
+bool BodyComparator::same(Function *A, Function *B) {
+	if (A->size() != B->size() || !same(A->getFunctionType(), B->getFunctionType()))
+		return false;
+	number(A, left);
+	number(B, right);
+	if (left.size() != right.size())
+		return false;
+
+	for (Function::iterator BA = A->begin(), BB = B->begin(); BA != A->end();
+	     ++BA, ++BB) {
+		BasicBlock::iterator IA = BA->begin(), IB = BB->begin();
+		for (;;) {
+			while (IA != BA->end() && isa<DbgInfoIntrinsic>(&*IA))
+				++IA;
+			while (IB != BB->end() && isa<DbgInfoIntrinsic>(&*IB))
+				++IB;
+			if (IA == BA->end() || IB == BB->end()) {
+				if (IA != BA->end() || IB != BB->end())
+					return false;
+				break;
+			}
+			if (!same(&*IA, &*IB))
+				return false;
+			++IA;
+			++IB;
+		}
+	}
+	return true;
+}
+
+};
+
+bool sameBody(Function *A, Function *B) {
+	return BodyComparator().same(A, B);
+}
+
+}; //end of namespace rsc
@@ -1,12 +1,13 @@
 #pragma once
 
-#include <llvm/DebugInfo.h>
-#include <llvm/Module.h>
-#include <llvm/Instructions.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/StringExtras.h>
-#include <llvm/Support/ConstantRange.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/ConstantRange.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 #include <map>
@@ -15,24 +16,123 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <vector>
+
+#include "rsc_Global.h"
+#include "rsc_FuncPtrSolver.h"
 
 class CallGraphPass : public IterativeModulePass {
 private:
 	bool runOnFunction(llvm::Function *);
+	void annotateLoadStores(llvm::Module *);
 	void processInitializers(llvm::Module *, llvm::Constant *, llvm::GlobalValue *);
 	bool mergeFuncSet(FuncSet &S, const std::string &Id);
-	bool mergeFuncSet(FuncSet &Dst, const FuncSet &Src);
+	bool mergeFuncSet(FuncSet &Dst, FuncSetRef Src);
+	bool mergeFuncSet(FuncSetRef &Dst, FuncSetRef Src);
+	bool mergeFuncSetOrType(FuncSet &S, const std::string &Id, llvm::Type *Ty);
 	bool findFunctions(llvm::Value *, FuncSet &);
-	bool findFunctions(llvm::Value *, FuncSet &, 
+	bool findFunctions(llvm::Value *, FuncSet &, llvm::Type *,
 	                   llvm::SmallPtrSet<llvm::Value *, 4>);
+	void buildCallGraph(ModuleList &modules);
+	void releaseSets();
+
+	// type-based fallback for indirect calls
+	llvm::StringSet<> Refined;
+	std::vector<std::pair<std::string, const void *> > PendingDecls;
+	const void *typeKey(llvm::FunctionType *FTy, bool Insert);
+	const void *calleeTypeKey(llvm::Type *Ty);
+	FuncSetRef getTypeCandidates(llvm::Type *Ty);
+	FuncSetRef getTypeCandidates(const void *Key);
+	bool isRefined(llvm::Function *F);
+	void resolvePendingDecls();
+
+	// identities that survive module eviction, for out-of-core runs and
+	// reload()
+	bool StandIns;
+	llvm::StringSet<> TypeNames;
+	llvm::Function *canon(llvm::Function *F);
+
+	// sets grown one function at a time while initializing, interned once
+	// all modules are in, so that no partial set stays in the pool
+	std::map<std::string, FuncSet> InitFuncPtrs;
+	llvm::DenseMap<const void *, FuncSet> InitTypeFuncs;
+	bool Interned;
+	void internInitSets();
+
+	// kind ID of the MD_ID keys, in the context of the current module
+	unsigned IdKind;
 
+	// inclusion-based mode, see FuncPtrSolver.cc
+	FuncPtrSolver Solver;
+	llvm::SmallPtrSet<llvm::Function *, 16> Extracted;
+	unsigned NumModules, NumPasses;
+	void addFlow(unsigned Dst, llvm::Value *V);
+	void addArgFlows(FuncSetRef Callees, unsigned No,
+	                 const std::vector<unsigned> &Srcs, FuncSetRef Base);
+
+	// argument No of a call through Key, for the type fallback
+	struct FallbackArg {
+		unsigned Key, No;
+		const void *TyKey;
+		std::vector<unsigned> Srcs;
+		FuncSetRef Base;
+	};
+	std::vector<FallbackArg> FallbackArgs;
+	bool applyFallbackArgs();
+
+	// Kept once enableReload() is called: the constraints each module
+	// added, by solver node, so that reload() can replace them, and the
+	// keys each refined indirect call reads
+	struct ModuleCons {
+		std::vector<std::pair<unsigned, FuncSetRef> > Bases;
+		std::vector<std::pair<unsigned, unsigned> > Copies;
+		std::vector<FallbackArg> Calls;        // through function pointers
+		std::vector<std::pair<std::string, llvm::Function *> > Inits;
+	};
+	bool KeepCons, Apply;
+	ModuleCons *Cur;
+	llvm::DenseMap<llvm::Module *, unsigned> ModuleIds;
+	std::vector<ModuleCons> Cons;
+	llvm::DenseMap<llvm::CallInst *, std::vector<std::string> > SiteKeys;
+	void addInit(const std::string &Id, llvm::Function *F);
+	void addBase(unsigned Dst, FuncSetRef S);
+	void addCopy(unsigned Src, unsigned Dst);
+	void addCall(const FallbackArg &FA);
+	bool addTypeFallback(const FallbackArg &FA);
+	void resolveCall(llvm::Function *F, llvm::CallInst *CI, FuncSet &FS);
+	bool sameExports(llvm::Module *A, llvm::Module *B);
+
+	// unification-based mode (-fp-unify), see CallGraphUnify.cc
+	std::map<std::string, unsigned> KeyIds;
+	std::vector<unsigned> Parent, Rank;
+	std::vector<FuncSetRef> ClassFuncs;            // valid at class roots
+	bool Materialized;
+
+	unsigned getClass(const std::string &Id);
+	unsigned findClass(unsigned K);
+	bool unify(unsigned A, unsigned B);
+	void collectSources(llvm::Value *, FuncSet &, std::vector<std::string> &,
+	                    llvm::SmallPtrSet<llvm::Value *, 4> &);
+	bool unifyFlow(const std::string &Id, llvm::Value *V);
+	void findClassFunctions(llvm::Value *V, FuncSet &S);
+	bool unifyOnFunction(llvm::Function *);
+	void materializeClasses();
 
 public:
 	CallGraphPass(GlobalContext *Ctx_)
-		: IterativeModulePass(Ctx_, "CallGraph") { }
+		: IterativeModulePass(Ctx_, "CallGraph"), IdKind(0), Solver(Ctx_),
+		  NumModules(0), NumPasses(0), StandIns(false), KeepCons(false),
+		  Apply(true), Cur(NULL), Materialized(false), Interned(false) { }
 	virtual bool doInitialization(llvm::Module *);
 	virtual bool doFinalization(llvm::Module *);
 	virtual bool doModulePass(llvm::Module *);
+	virtual void run(ModuleList &modules);
+	virtual void run(const ModuleFileList &files);
+
+	// keep what reload() needs, before run(ModuleList &)
+	void enableReload();
+	// replace Old by New in the results of run(), see CallGraph.cc
+	bool reload(llvm::Module *Old, llvm::Module *New, ModuleList &modules);
 
 	// debug
 	void dumpFuncPtrs();
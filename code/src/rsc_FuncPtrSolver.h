@@ -0,0 +1,88 @@
+#pragma once
+
+#include <llvm/ADT/DenseSet.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rsc_Global.h"
+
+// Worklist solver for the inclusion constraints between FuncPtrs keys.
+//
+// Each key is a node holding its current set (Pts) and the part of it not
+// yet pushed to its successors (Delta), so every flow only carries newly
+// found targets. Indirect calls are complex constraints attached to the
+// node of the called pointer: when a function F reaches that node, copy
+// edges into arg.F.<no> are added on the fly.
+//
+// Cycles in the key graph (e.g. callbacks handed back and forth between
+// registration helpers) are collapsed into one representative as they are
+// found. Following lazy cycle detection, a DFS is only started when an
+// edge propagates nothing and both ends already hold the same set, which
+// with interned sets is a pointer comparison.
+class FuncPtrSolver {
+	struct CallCons {
+		unsigned No;
+		std::vector<unsigned> Srcs;
+		FuncSetRef Base;
+	};
+
+	GlobalContext *Ctx;
+
+	std::map<std::string, unsigned> Ids;
+	std::vector<std::string> Names;
+	std::vector<unsigned> Rep;                  // collapsed cycles
+	std::vector<FuncSetRef> Pts, Delta;
+	std::vector<std::vector<unsigned> > Succs;
+	std::vector<std::vector<CallCons> > Calls;
+	llvm::DenseSet<std::pair<unsigned, unsigned> > Edges, Checked;
+
+	std::vector<unsigned> Worklist;
+	std::vector<bool> Queued;
+	std::vector<bool> Settled;                  // see preset()
+
+	bool Changed;
+	unsigned NumCollapsed;
+
+	unsigned find(unsigned N);
+	bool settled(unsigned N) const { return N < Settled.size() && Settled[N]; }
+	void push(unsigned N);
+	void propagate(unsigned Dst, FuncSetRef S);
+	void collapse(unsigned A, unsigned B);
+	void collapseCycles(unsigned Root);
+
+public:
+	FuncPtrSolver(GlobalContext *Ctx_)
+		: Ctx(Ctx_), Changed(false), NumCollapsed(0) { }
+
+	// the node of a key, which may since have been collapsed into
+	// another; every operation below maps it to its representative
+	unsigned getNode(const std::string &Id);
+	// the node of a key if it has one, ~0U otherwise
+	unsigned lookup(const std::string &Id) const;
+	const std::string &getName(unsigned N) const { return Names[N]; }
+	unsigned size() const { return Names.size(); }
+	// the current set of a node
+	FuncSetRef getPts(unsigned N) { return Pts[find(N)]; }
+
+	// Start N at S, its final set under the constraints added from here
+	// on. Until the next solve(), constraints between preset nodes carry
+	// nothing, as their sets already hold it.
+	void preset(unsigned N, FuncSetRef S);
+
+	// Dst >= S
+	void addBase(unsigned Dst, FuncSetRef S);
+	// Dst >= Src
+	void addCopy(unsigned Src, unsigned Dst);
+	// for each F reaching Callee: arg.F.No >= Srcs + Base
+	void addCall(unsigned Callee, unsigned No,
+		     const std::vector<unsigned> &Srcs, FuncSetRef Base);
+
+	// propagate until the worklist is empty, returns whether any set grew
+	bool solve();
+
+	void writeBack();
+
+	unsigned numCollapsed() const { return NumCollapsed; }
+};
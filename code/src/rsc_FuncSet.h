@@ -0,0 +1,103 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "MemLog.h"
+
+// Sorted, immutable set of functions with a precomputed hash. Instances
+// are only created by FuncSetPool, which interns them so that equal sets
+// share one copy.
+class FuncSetData {
+	friend class FuncSetPool;
+	friend class FuncSetRef;
+
+	std::vector<llvm::Function *> Elems;
+	size_t Hash;
+
+	explicit FuncSetData(std::vector<llvm::Function *> &E) {
+		Elems.swap(E);
+		Hash = llvm::hash_combine_range(Elems.begin(), Elems.end());
+	}
+
+public:
+	static const FuncSetData Empty;
+
+	FuncSetData() : Hash(llvm::hash_combine_range(Elems.begin(), Elems.end())) { }
+};
+
+// Handle to an interned set. Equal sets have equal handles, so comparing
+// two sets is a pointer comparison. A default handle is the empty set.
+class FuncSetRef {
+	friend class FuncSetPool;
+
+	const FuncSetData *D;
+
+	explicit FuncSetRef(const FuncSetData *D_) : D(D_) { }
+
+public:
+	typedef std::vector<llvm::Function *>::const_iterator iterator;
+
+	FuncSetRef() : D(&FuncSetData::Empty) { }
+
+	iterator begin() const { return D->Elems.begin(); }
+	iterator end() const { return D->Elems.end(); }
+	unsigned size() const { return D->Elems.size(); }
+	bool empty() const { return D->Elems.empty(); }
+	bool count(llvm::Function *F) const {
+		return std::binary_search(begin(), end(), F);
+	}
+
+	const FuncSetData *data() const { return D; }
+
+	bool operator==(const FuncSetRef &R) const { return D == R.D; }
+	bool operator!=(const FuncSetRef &R) const { return D != R.D; }
+};
+
+class FuncSetPool {
+	struct DataHash {
+		size_t operator()(const FuncSetData *S) const { return S->Hash; }
+	};
+	struct DataEqual {
+		bool operator()(const FuncSetData *A, const FuncSetData *B) const {
+			return A->Hash == B->Hash && A->Elems == B->Elems;
+		}
+	};
+
+	typedef std::pair<const FuncSetData *, const FuncSetData *> DataPair;
+
+	typedef std::unordered_set<FuncSetData *, DataHash, DataEqual> DataSet;
+
+	DataSet Sets;
+
+	// memo of unite(), cleared once it holds MaxUnions pairs
+	static const unsigned MaxUnions = 1 << 16;
+	llvm::DenseMap<DataPair, const FuncSetData *> Unions;
+
+	FuncSetRef intern(std::vector<llvm::Function *> &Elems);
+
+public:
+	FuncSetPool() { }
+	~FuncSetPool();
+
+	FuncSetRef get(const llvm::SmallPtrSet<llvm::Function *, 8> &S);
+	FuncSetRef unite(FuncSetRef A, FuncSetRef B);
+	FuncSetRef subtract(FuncSetRef A, FuncSetRef B);
+
+	// drop the memo of unions, e.g. once the fixpoint is reached
+	void clearUnions();
+
+	// free every set not in Live; handles to them must not be used again
+	void sweep(const llvm::DenseSet<const FuncSetData *> &Live);
+
+	unsigned size() const { return Sets.size(); }
+	rsc::mem::Usage memory() const;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringRef.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CallGraphCSR.h"
+#include "MemLog.h"
+#include "rsc_FuncSet.h"
+
+typedef std::vector< std::pair<llvm::Module *, llvm::StringRef> > ModuleList;
+typedef std::vector<std::string> ModuleFileList;
+typedef std::map<llvm::StringRef, llvm::Function *> FuncMap;
+typedef llvm::SmallPtrSet<llvm::Function *, 8> FuncSet;
+typedef std::map<std::string, FuncSetRef> FuncPtrMap;
+typedef llvm::DenseMap<llvm::CallInst *, FuncSetRef> CalleeMap;
+// keyed by CallGraphPass::getTypeKey()
+typedef llvm::DenseMap<const void *, FuncSetRef> TypeFuncMap;
+
+struct GlobalContext {
+	// Map global function name to function defination
+	FuncMap Funcs;
+
+	// Owner of the interned callee sets below
+	FuncSetPool FuncSets;
+
+	// Map function pointers (IDs) to possible assignments
+	FuncPtrMap FuncPtrs;
+
+	// Map a callsite to all potential callees
+	CalleeMap Callees;
+
+	// Map a function type to the address-taken functions of that type
+	TypeFuncMap TypeFuncs;
+
+	// Frozen form of Callees, built once the call graph is final
+	rsc::CallGraphCSR CallGraph;
+
+	// Per-structure sizes at stage boundaries, if set and opened
+	rsc::MemLog *MemLog;
+
+	// Out-of-core runs: resident declarations standing in for the
+	// functions of evicted modules, one per scope name; those of defined
+	// functions have a body of one unreachable block
+	std::unique_ptr<llvm::LLVMContext> StubContext;
+	std::unique_ptr<llvm::Module> StubModule;
+
+	GlobalContext() : MemLog(NULL) { }
+
+	void memory(rsc::mem::Snapshot &S) const {
+		rsc::mem::Usage P = rsc::mem::of(FuncPtrs);
+		for (FuncPtrMap::const_iterator i = FuncPtrs.begin(),
+		     e = FuncPtrs.end(); i != e; ++i)
+			P.bytes += i->first.capacity();
+		S.add("FuncPtrs", P);
+		S.add("FuncSets", FuncSets.memory());
+		S.add("Callees", rsc::mem::of(Callees));
+		S.add("Funcs", rsc::mem::of(Funcs));
+		S.add("TypeFuncs", rsc::mem::of(TypeFuncs));
+		if (StubModule)
+			S.add("Stubs", rsc::mem::Usage(StubModule->size(),
+				StubModule->size() * sizeof(llvm::Function)));
+		CallGraph.memory(S);
+	}
+
+	void logMemory(llvm::StringRef Stage) {
+		if (!MemLog || !MemLog->is_open())
+			return;
+		rsc::mem::Snapshot S;
+		memory(S);
+		MemLog->record(Stage, S);
+	}
+};
+
+class IterativeModulePass {
+protected:
+	GlobalContext *Ctx;
+	const char *ID;
+
+	// Out-of-core runs: each module is loaded into a fresh LLVMContext
+	// for one step and evicted right after, so neither its IR nor the
+	// types and constants it uniqued outlive the step. After the first
+	// round, a module is only reloaded if one of the keys it read in its
+	// last round has changed since; keys are pass-specific ids reported
+	// through readKey() and changedKey().
+	bool OutOfCore;
+	unsigned Clock, Current;
+	std::vector<unsigned> KeyStamp;                    // clock of last change
+	std::vector<unsigned> LastRun;                     // by module
+	std::vector<std::vector<unsigned> > Inputs;        // by module
+
+	void readKey(unsigned Key);
+	void changedKey(unsigned Key);
+	bool isStale(unsigned Idx) const;
+
+public:
+	IterativeModulePass(GlobalContext *Ctx_, const char *ID_)
+		: Ctx(Ctx_), ID(ID_), OutOfCore(false), Clock(0), Current(~0U) { }
+
+	// run on each module before iterative pass
+	virtual bool doInitialization(llvm::Module *M)
+		{ return true; }
+
+	// run on each module after iterative pass
+	virtual bool doFinalization(llvm::Module *M)
+		{ return true; }
+
+	// iterative pass
+	virtual bool doModulePass(llvm::Module *M)
+		{ return false; }
+
+	virtual void run(ModuleList &modules);
+	virtual void run(const ModuleFileList &files);
+};
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Regex.h>
+
+#include <z3++.h>
+
+#include "CallGraphCSR.h"
+#include "Formula.h"
+#include "Skeleton.h"
+#include "Slice.h"
+#include "Synthetic.h"
+#include "Tabulation.h"
+#include "TrivialLeaf.h"
+#include "rsc_CallGraph.h"
+
+using namespace llvm;
+using namespace rsc;
+
+/*
+ * rsc-bench runs microbenchmarks of the analysis hot paths on fixed
+ * synthetic inputs, in the spirit of Google benchmark: each benchmark is
+ * repeated until it has run for -min-time seconds, and the time and the
+ * number of heap allocations per iteration are reported.
+ */
+
+static cl::opt<double>
+MinTime("min-time",
+	cl::init(0.5),
+	cl::desc("Minimum running time of each benchmark in seconds"));
+
+static cl::opt<std::string>
+Filter("filter",
+       cl::init(""),
+       cl::desc("Only run benchmarks whose names match this regex"));
+
+static cl::opt<unsigned>
+Functions("functions",
+	  cl::init(2000),
+	  cl::desc("Number of functions in the synthetic module"));
+
+/* Allocation counting, through the global operator new */
+
+static unsigned long long nr_allocs;
+
+void *operator new(size_t size) {
+	++nr_allocs;
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+class Benchmark {
+public:
+	const char *name;
+
+	Benchmark(const char *name) : name(name) {}
+	virtual ~Benchmark() {}
+
+	// setup is not measured
+	virtual void setup() {}
+	virtual void run() = 0;
+};
+
+static std::vector<Benchmark *> &benchmarks() {
+	static std::vector<Benchmark *> all;
+	return all;
+}
+
+#define BENCHMARK(cls) static cls cls##_instance; \
+	static bool cls##_registered = (benchmarks().push_back(&cls##_instance), true)
+
+/* Shared inputs */
+
+// CallGraphPass reports its rounds on stderr, which would flood the table
+class Quiet {
+	int saved;
+public:
+	Quiet() : saved(dup(2)) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, 2);
+		close(null);
+	}
+	~Quiet() {
+		dup2(saved, 2);
+		close(saved);
+	}
+};
+
+// members are destroyed in reverse order, the context last
+struct Inputs {
+	LLVMContext C;
+	std::unique_ptr<Module> M;
+	std::unique_ptr<CallGraph> CG;
+	std::unique_ptr<GlobalContext> Ctx;     // CSR with indirect calls
+
+	Inputs() {
+		SyntheticParams P;
+		P.functions = Functions;
+		M = makeSyntheticModule(C, P);
+		CG.reset(new CallGraph(*M));
+
+		Quiet Q;
+		Ctx.reset(new GlobalContext());
+		ModuleList modules(1, std::make_pair(M.get(),
+				StringRef(M->getModuleIdentifier())));
+		CallGraphPass CGP(Ctx.get());
+		CGP.run(modules);
+	}
+};
+
+static Inputs &inputs() {
+	static Inputs I;
+	return I;
+}
+
+static Module &module() { return *inputs().M; }
+static CallGraph &callgraph() { return *inputs().CG; }
+static const CallGraphCSR &csr() { return inputs().Ctx->CallGraph; }
+
+static StringSet<> &entries() {
+	static StringSet<> names;
+	if (names.empty())
+		addDefaultAtomicEntries(names);
+	return names;
+}
+
+static StringSet<> &sleepers() {
+	static StringSet<> names;
+	if (names.empty())
+		addDefaultSleepingPrimitives(names);
+	return names;
+}
+
+/* Benchmarks */
+
+class CSRBuild : public Benchmark {
+public:
+	CSRBuild() : Benchmark("csr_build") {}
+	void setup() { callgraph(); }
+	void run() {
+		CallGraphCSR G;
+		G.build(callgraph());
+	}
+};
+BENCHMARK(CSRBuild);
+
+// function pointer resolution and the CSR freeze, as the rsc pass runs them
+class CallGraphBuild : public Benchmark {
+public:
+	CallGraphBuild() : Benchmark("callgraph_pass") {}
+	void setup() { csr(); }
+	void run() {
+		Quiet Q;
+		GlobalContext Ctx;
+		ModuleList modules(1, std::make_pair(&module(),
+				StringRef(module().getModuleIdentifier())));
+		CallGraphPass CGP(&Ctx);
+		CGP.run(modules);
+	}
+};
+BENCHMARK(CallGraphBuild);
+
+/*
+ * Interning and merging of callee sets: overlapping sets of 16 functions
+ * are interned, then folded into running unions as the solver does.
+ */
+class FuncSetMerge : public Benchmark {
+	std::vector<FuncSet> sets;
+public:
+	FuncSetMerge() : Benchmark("funcset_merge") {}
+	void setup() {
+		std::vector<Function *> fs;
+		for (Function &F : module())
+			fs.push_back(&F);
+		for (unsigned i = 0; i < 256; ++i) {
+			FuncSet S;
+			for (unsigned k = 0; k < 16; ++k)
+				S.insert(fs[(i * 7 + k * 13) % fs.size()]);
+			sets.push_back(S);
+		}
+	}
+	void run() {
+		FuncSetPool pool;
+		std::vector<FuncSetRef> refs;
+		for (const FuncSet &S : sets)
+			refs.push_back(pool.get(S));
+		FuncSetRef acc[8];
+		for (unsigned round = 0; round < 4; ++round)
+			for (unsigned i = 0; i < refs.size(); ++i)
+				acc[i % 8] = pool.unite(acc[i % 8], refs[i]);
+	}
+};
+BENCHMARK(FuncSetMerge);
+
+class Condense : public Benchmark {
+	std::vector<unsigned> scc_of;
+public:
+	Condense() : Benchmark("condense") {}
+	void setup() { csr(); }
+	void run() { condense(csr(), scc_of); }
+};
+BENCHMARK(Condense);
+
+class SliceCompute : public Benchmark {
+public:
+	SliceCompute() : Benchmark("slice_compute") {}
+	void setup() { csr(); entries(); sleepers(); }
+	void run() {
+		SensitiveSlice S(entries(), sleepers());
+		S.compute(csr());
+	}
+};
+BENCHMARK(SliceCompute);
+
+class Trivial : public Benchmark {
+	StringSet<> inlined;
+public:
+	Trivial() : Benchmark("trivial_leaves") {}
+	void setup() { csr(); sleepers(); }
+	void run() {
+		TrivialLeaves T;
+		T.compute(csr(), inlined, sleepers());
+	}
+};
+BENCHMARK(Trivial);
+
+class Extract : public Benchmark {
+public:
+	Extract() : Benchmark("skeleton_extract") {}
+	void setup() { csr(); sleepers(); }
+	void run() {
+		Skeletons S(csr(), sleepers());
+		for (unsigned f = 0; f < csr().nr_functions(); ++f)
+			if (S.has_body(f))
+				S.of(f);
+	}
+};
+BENCHMARK(Extract);
+
+class Tabulate : public Benchmark {
+public:
+	Tabulate() : Benchmark("tabulation_solve") {}
+	void setup() { csr(); sleepers(); }
+	void run() {
+		Skeletons S(csr(), sleepers());
+		AtomicTabulation T(S);
+		for (unsigned f = 0; f < csr().nr_functions(); ++f)
+			T.add_entry(f);
+		T.solve();
+	}
+};
+BENCHMARK(Tabulate);
+
+class Witness : public Benchmark {
+	std::unique_ptr<Skeletons> S;
+	std::unique_ptr<AtomicTabulation> T;
+public:
+	Witness() : Benchmark("tabulation_witness") {}
+	void setup() {
+		S.reset(new Skeletons(csr(), sleepers()));
+		T.reset(new AtomicTabulation(*S));
+		for (unsigned f = 0; f < csr().nr_functions(); ++f)
+			T->add_entry(f);
+		T->solve();
+	}
+	void run() {
+		std::vector<AtomicTabulation::Step> chain;
+		for (const AtomicTabulation::Report &R : T->reports())
+			T->witness(R, chain);
+	}
+};
+BENCHMARK(Witness);
+
+/*
+ * Raw Z3 cost of a path condition: a hand-written conjunction of 32 atoms
+ * over 8 signatures is built and checked in a fresh solver. It does not go
+ * through __Formula, see formula_z3_expr for the AST cache.
+ */
+class Z3Conjunction : public Benchmark {
+	z3::context z3;
+public:
+	Z3Conjunction() : Benchmark("z3_conjunction") {}
+	void run() {
+		z3::expr e = z3.bool_val(true);
+		for (int i = 0; i < 32; ++i) {
+			z3::expr v = z3.int_const(("sig" + std::to_string(i % 8)).c_str());
+			e = e && (i & 1 ? v != z3.int_val(i) : v <= z3.int_val(i * 3));
+		}
+		z3::solver s(z3);
+		s.add(e);
+		s.check();
+	}
+};
+BENCHMARK(Z3Conjunction);
+
+/*
+ * The out-of-line members of the formula nodes are not part of this tree.
+ * The atoms below need these for their vtables; nothing calls them.
+ */
+const char *Atom::OP_SYMBOL[Atom::OP_END] = {
+	NULL, "==", "!=", "<", "<=", ">", ">=",
+};
+Operand *rsc::Constant::deep_copy(Context &, std::function<Expr*(Context&, Expr*)>) { abort(); }
+void rsc::Constant::serialize(std::ofstream &) { abort(); }
+Operand *Variable::deep_copy(Context &, std::function<Expr*(Context&, Expr*)>) { abort(); }
+void Variable::serialize(std::ofstream &) { abort(); }
+Formula Atom::deep_copy(Context &, std::function<Expr*(Context&, Expr*)>) { abort(); }
+void Atom::serialize(std::ofstream &) { abort(); }
+
+/*
+ * Conversion of a path condition to Z3 through the formula nodes: 32 atoms
+ * over 8 signatures, as in z3_conjunction, converted again at every
+ * iteration. With mutate, one constant changes in between, so its atom is
+ * rebuilt while the others come from the AST cache. The context is never
+ * freed, its destructor is out-of-line too.
+ */
+class FormulaZ3Expr : public Benchmark {
+	bool mutate;
+	Context *c;
+	std::vector<rsc::Constant *> constants;
+	std::vector<Formula> atoms;
+public:
+	FormulaZ3Expr(const char *name = "formula_z3_expr", bool mutate = false)
+		: Benchmark(name), mutate(mutate), c(NULL) {}
+	void setup() {
+		c = new Context();
+		for (int i = 0; i < 32; ++i) {
+			Variable *v = new Variable(*c);
+			v->name = "sig" + std::to_string(i % 8);
+			rsc::Constant *k = new rsc::Constant(*c);
+			k->i = i & 1 ? i : i * 3;
+			constants.push_back(k);
+			atoms.push_back(Formula(new Atom(*c, i & 1 ? Atom::OP_NE : Atom::OP_LE,
+							 v, k)));
+		}
+	}
+	void run() {
+		if (mutate)
+			constants[0]->i ^= 1;
+		z3::expr e = c->z3.bool_val(true);
+		for (const Formula &A : atoms)
+			e = e && A->z3_expr();
+	}
+};
+BENCHMARK(FormulaZ3Expr);
+
+class FormulaZ3Rebuild : public FormulaZ3Expr {
+public:
+	FormulaZ3Rebuild() : FormulaZ3Expr("formula_z3_expr_mutated", true) {}
+};
+BENCHMARK(FormulaZ3Rebuild);
+
+static void measure(Benchmark *B) {
+	typedef std::chrono::steady_clock Clock;
+
+	B->setup();
+	unsigned long long iters = 1;
+	for (;;) {
+		unsigned long long allocs = nr_allocs;
+		Clock::time_point start = Clock::now();
+		for (unsigned long long i = 0; i < iters; ++i)
+			B->run();
+		double secs = std::chrono::duration<double>(Clock::now() - start).count();
+		allocs = nr_allocs - allocs;
+
+		if (secs >= MinTime || iters >= (1ULL << 30)) {
+			printf("%-24s %12llu %14.1f ns/op %12.1f allocs/op\n", B->name,
+			       iters, secs * 1e9 / iters, (double)allocs / iters);
+			return;
+		}
+		// aim a bit past the minimum time
+		double scale = secs > 0 ? MinTime * 1.4 / secs : 100;
+		iters = std::max(iters + 1, (unsigned long long)(iters * std::min(scale, 100.0)));
+	}
+}
+
+int main(int argc, char **argv) {
+	cl::ParseCommandLineOptions(argc, argv, "RSC microbenchmarks\n");
+
+	Regex match(Filter);
+	printf("%-24s %12s %20s %22s\n", "benchmark", "iterations", "time", "allocations");
+	for (Benchmark *B : benchmarks())
+		if (Filter.empty() || match.match(B->name))
+			measure(B);
+	return 0;
+}
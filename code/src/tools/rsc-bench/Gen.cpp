@@ -0,0 +1,155 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Synthetic.h"
+
+using namespace llvm;
+using namespace rsc;
+
+/*
+ * rsc-gen writes a corpus of kernel-like bitcode files, for running the
+ * whole pipeline without a kernel tree. Files are grouped into SCCs of
+ * -scc-size files calling each other in a ring; each group also calls
+ * into the next group, so the file dependency graph is a chain of SCCs.
+ *
+ * The output directory gets bcs/file<i>.bc, abs_bclist as produced by
+ * "analyze.sh build", and planted-bugs, the functions sleeping inside
+ * their own atomic section.
+ */
+
+static cl::opt<std::string>
+OutDir("o",
+       cl::init("corpus"),
+       cl::desc("Output directory"));
+
+static cl::opt<unsigned>
+Functions("functions",
+	  cl::init(10000),
+	  cl::desc("Total number of functions"));
+
+static cl::opt<unsigned>
+PerFile("per-file",
+	cl::init(200),
+	cl::desc("Functions per file"));
+
+static cl::opt<unsigned>
+SCCSize("scc-size",
+	cl::init(4),
+	cl::desc("Number of files in each file-level SCC"));
+
+static cl::opt<unsigned>
+Calls("calls",
+      cl::init(4),
+      cl::desc("Direct calls per function"));
+
+static cl::opt<unsigned>
+ExternPercent("extern-percent",
+	      cl::init(10),
+	      cl::desc("Percentage of calls going to another file"));
+
+static cl::opt<unsigned>
+FPPercent("fp-percent",
+	  cl::init(10),
+	  cl::desc("Percentage of functions calling through an ops table"));
+
+static cl::opt<unsigned>
+AtomicPercent("atomic-percent",
+	      cl::init(10),
+	      cl::desc("Percentage of functions with an atomic section"));
+
+static cl::opt<unsigned>
+SleepPercent("sleep-percent",
+	     cl::init(5),
+	     cl::desc("Percentage of functions calling a sleeping primitive"));
+
+static cl::opt<unsigned>
+Seed("seed",
+     cl::init(1),
+     cl::desc("Random seed"));
+
+int main(int argc, char **argv) {
+	cl::ParseCommandLineOptions(argc, argv, "kernel-like bitcode corpus generator\n");
+
+	unsigned nr_files = (Functions + PerFile - 1) / PerFile;
+	unsigned scc = SCCSize ? SCCSize : 1;
+
+	std::string bcdir = OutDir + "/bcs";
+	if (std::error_code EC = sys::fs::create_directories(bcdir)) {
+		errs() << "Cannot create " << bcdir << ": " << EC.message() << "\n";
+		return 1;
+	}
+	SmallString<256> abs(OutDir);
+	sys::fs::make_absolute(abs);
+
+	std::ofstream bclist((OutDir + "/abs_bclist").c_str());
+	std::ofstream planted_out((OutDir + "/planted-bugs").c_str());
+	unsigned nr_planted = 0;
+
+	for (unsigned i = 0; i < nr_files; ++i) {
+		// the next file in the ring of this group, or the next group
+		unsigned group = i / scc, next;
+		if (scc > 1)
+			next = group * scc + (i % scc + 1) % scc;
+		else
+			next = i + 1;
+		if (next >= nr_files)
+			next = scc > 1 ? group * scc : nr_files;
+
+		SyntheticParams P;
+		P.functions = std::min<unsigned>(PerFile, Functions - i * PerFile);
+		P.calls = Calls;
+		P.fp_percent = FPPercent;
+		P.atomic_percent = AtomicPercent;
+		P.sleep_percent = SleepPercent;
+		P.seed = Seed * 7919 + i;
+
+		LLVMContext C;
+		std::vector<std::string> planted;
+		std::string extern_prefix = next < nr_files ? "_" + std::to_string(next) + "_" : "";
+		std::unique_ptr<Module> M = makeSyntheticModule(C, P, "_" + std::to_string(i) + "_",
+								extern_prefix, ExternPercent,
+								&planted);
+
+		// the first file of a group also calls into the next group, so
+		// that the SCCs form a chain
+		unsigned chain = (group + 1) * scc;
+		if (scc > 1 && i % scc == 0 && chain < nr_files) {
+			Function *F = M->getFunction("f_" + std::to_string(i) + "_0");
+			Function *Callee = Function::Create(F->getFunctionType(),
+				GlobalValue::ExternalLinkage,
+				"f_" + std::to_string(chain) + "_0", M.get());
+			Value *Args[] = { &*F->arg_begin() };
+			CallInst::Create(Callee, Args, "",
+					 &*F->getEntryBlock().getFirstInsertionPt());
+		}
+
+		std::string file = bcdir + "/file" + std::to_string(i) + ".bc";
+		std::error_code EC;
+		raw_fd_ostream out(file, EC, sys::fs::F_None);
+		if (EC) {
+			errs() << "Cannot write " << file << ": " << EC.message() << "\n";
+			return 1;
+		}
+		WriteBitcodeToFile(M.get(), out);
+
+		bclist << abs.str().str() << "/bcs/file" << i << ".bc\n";
+		for (const std::string &fn : planted)
+			planted_out << fn << "\n";
+		nr_planted += planted.size();
+	}
+
+	errs() << "rsc-gen: " << Functions << " functions in " << nr_files
+	       << " files, " << nr_planted << " planted bugs\n";
+	return 0;
+}
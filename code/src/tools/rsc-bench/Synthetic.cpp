@@ -0,0 +1,135 @@
+#include "Synthetic.h"
+
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+
+using namespace llvm;
+
+namespace rsc {
+
+namespace {
+
+// a small LCG, so that every run generates the same module
+class Random {
+	unsigned long long state;
+public:
+	Random(unsigned seed) : state(seed * 2862933555777941757ULL + 3037000493ULL) {}
+	unsigned next(unsigned n) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return (unsigned)(state >> 33) % n;
+	}
+	bool chance(unsigned percent) { return next(100) < percent; }
+};
+
+}
+
+static Function *declare(Module &M, FunctionType *FTy, const std::string &name) {
+	if (Function *F = M.getFunction(name))
+		return F;
+	return Function::Create(FTy, GlobalValue::ExternalLinkage, name, &M);
+}
+
+std::unique_ptr<Module>
+makeSyntheticModule(LLVMContext &C, const SyntheticParams &P,
+		    const std::string &prefix, const std::string &extern_prefix,
+		    unsigned extern_percent, std::vector<std::string> *planted) {
+	std::unique_ptr<Module> M(new Module("synthetic" + prefix, C));
+	Random R(P.seed);
+
+	Type *I32 = Type::getInt32Ty(C);
+	Type *Void = Type::getVoidTy(C);
+	FunctionType *FnTy = FunctionType::get(I32, I32, false);
+	FunctionType *VoidTy = FunctionType::get(Void, false);
+	FunctionType *SleepTy = FunctionType::get(Void, I32, false);
+
+	Function *Disable = declare(*M, VoidTy, "preempt_disable");
+	Function *Enable = declare(*M, VoidTy, "preempt_enable");
+	Function *Sleep = declare(*M, SleepTy, "msleep");
+
+	std::vector<Function *> funcs;
+	for (unsigned i = 0; i < P.functions; ++i)
+		funcs.push_back(Function::Create(FnTy, GlobalValue::ExternalLinkage,
+						  "f" + prefix + std::to_string(i), M.get()));
+
+	// ops tables of two function pointers each
+	PointerType *FnPtrTy = PointerType::getUnqual(FnTy);
+	ArrayType *OpsTy = ArrayType::get(FnPtrTy, 2);
+	std::vector<GlobalVariable *> ops;
+	for (unsigned i = 0; i < P.functions / 16 + 1; ++i) {
+		Constant *Elems[] = { funcs[R.next(P.functions)], funcs[R.next(P.functions)] };
+		ops.push_back(new GlobalVariable(*M, OpsTy, true, GlobalValue::InternalLinkage,
+						 ConstantArray::get(OpsTy, Elems),
+						 "ops" + prefix + std::to_string(i)));
+	}
+
+	for (unsigned i = 0; i < P.functions; ++i) {
+		Function *F = funcs[i];
+		Value *X = &*F->arg_begin();
+		BasicBlock *Entry = BasicBlock::Create(C, "entry", F);
+		BasicBlock *Then = BasicBlock::Create(C, "then", F);
+		BasicBlock *Else = BasicBlock::Create(C, "else", F);
+		BasicBlock *Join = BasicBlock::Create(C, "join", F);
+		IRBuilder<> B(Entry);
+
+		bool atomic = R.chance(P.atomic_percent);
+		if (atomic)
+			B.CreateCall(Disable, {});
+		B.CreateCondBr(B.CreateICmpSGT(X, ConstantInt::get(I32, i)), Then, Else);
+
+		// direct calls, split over both arms
+		for (unsigned k = 0; k < P.calls; ++k) {
+			B.SetInsertPoint(k & 1 ? Else : Then);
+			Function *Callee;
+			if (R.chance(extern_percent) && !extern_prefix.empty())
+				Callee = declare(*M, FnTy, "f" + extern_prefix
+						 + std::to_string(R.next(P.functions)));
+			else if (i > 0 && R.chance(P.back_percent))
+				Callee = funcs[R.next(i)];
+			else if (i + 1 < P.functions)
+				Callee = funcs[i + 1 + R.next(P.functions - i - 1)];
+			else
+				continue;
+			B.CreateCall(Callee, X);
+		}
+
+		// pick a function pointer on each arm and merge them in a PHI
+		Value *FP[2] = { NULL, NULL };
+		bool indirect = R.chance(P.fp_percent);
+		if (indirect) {
+			for (unsigned k = 0; k < 2; ++k) {
+				B.SetInsertPoint(k ? Else : Then);
+				GlobalVariable *G = ops[R.next(ops.size())];
+				Value *P0 = B.CreateLoad(B.CreateConstGEP2_32(OpsTy, G, 0, 0));
+				Value *P1 = B.CreateLoad(B.CreateConstGEP2_32(OpsTy, G, 0, 1));
+				FP[k] = B.CreateSelect(B.CreateICmpEQ(X, ConstantInt::get(I32, k)), P0, P1);
+			}
+		}
+		IRBuilder<>(Then).CreateBr(Join);
+		IRBuilder<>(Else).CreateBr(Join);
+
+		B.SetInsertPoint(Join);
+		if (indirect) {
+			PHINode *Phi = B.CreatePHI(FnPtrTy, 2);
+			Phi->addIncoming(FP[0], Then);
+			Phi->addIncoming(FP[1], Else);
+			B.CreateCall(Phi, X);
+		}
+		if (R.chance(P.sleep_percent)) {
+			B.CreateCall(Sleep, X);
+			if (atomic && planted)
+				planted->push_back(F->getName().str());
+		}
+		if (atomic)
+			B.CreateCall(Enable, {});
+		B.CreateRet(X);
+	}
+
+	return M;
+}
+
+};
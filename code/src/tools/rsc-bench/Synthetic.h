@@ -0,0 +1,53 @@
+//===---- Synthetic.h - Kernel-like synthetic modules -----------*- C++ -*-===//
+
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+namespace rsc {
+
+/*
+ * Shape of a synthetic module. Percentages are per function: the share of
+ * functions with an atomic section, with a sleeping call, and with an
+ * indirect call through a PHI/select web over an ops table.
+ */
+struct SyntheticParams {
+	unsigned functions;
+	unsigned calls;            // direct calls per function
+	unsigned back_percent;     // calls going backwards, forming cycles
+	unsigned atomic_percent;
+	unsigned sleep_percent;
+	unsigned fp_percent;
+	unsigned seed;
+
+	SyntheticParams()
+		: functions(1000), calls(4), back_percent(2), atomic_percent(10),
+		  sleep_percent(5), fp_percent(10), seed(1) {}
+};
+
+/*
+ * Generate a deterministic module shaped like kernel code: functions
+ * f<prefix><i> calling later functions (and, rarely, earlier ones),
+ * preempt_disable()/preempt_enable() sections, msleep() calls and ops
+ * tables of function pointers. A share of the calls, extern_percent, goes
+ * to functions of another module, declared with the given external prefix.
+ *
+ * Functions calling msleep() inside their own atomic section are planted
+ * bugs; their names are appended to planted if it is given.
+ */
+std::unique_ptr<llvm::Module>
+makeSyntheticModule(llvm::LLVMContext &C, const SyntheticParams &P,
+		    const std::string &prefix = "",
+		    const std::string &extern_prefix = "",
+		    unsigned extern_percent = 0,
+		    std::vector<std::string> *planted = NULL);
+
+};
+
+#endif  /* SYNTHETIC_H */
@@ -0,0 +1,200 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+/*
+ * rsc-closure extracts the bodies of a function and of its transitive
+ * callees into a single module, for analyzing one function without
+ * loading the whole linux.bc. Bitcode files are opened lazily and only the
+ * bodies in the closure are materialized; a symbol index written by
+ * depgen.py tells which file defines each external symbol.
+ *
+ * Functions referenced in a body (called or taken as address) are
+ * followed; function pointers stored in global tables are not.
+ */
+
+static cl::opt<std::string>
+TARGET(cl::Positional, cl::Required, cl::desc("<function>"));
+
+static cl::opt<std::string>
+INDEX("index",
+      cl::init("symbol-index"),
+      cl::desc("Symbol index mapping each symbol to its bitcode file"));
+
+static cl::opt<std::string>
+OUTPUT("o",
+       cl::init(""),
+       cl::desc("Output bitcode file, <function>.bc by default"));
+
+class Closure {
+	LLVMContext &C;
+	StringMap<std::string> index;
+	StringMap<std::unique_ptr<Module>> modules;
+
+	SmallPtrSet<Function *, 32> funcs;
+	std::vector<Function *> worklist;
+
+	Module *load(StringRef file) {
+		std::unique_ptr<Module> &M = modules[file];
+		if (!M) {
+			SMDiagnostic Err;
+			M = getLazyIRFileModule(file, Err, C);
+			if (!M)
+				Err.print("rsc-closure", errs());
+		}
+		return M.get();
+	}
+
+	void add(Function *F) {
+		if (funcs.insert(F).second)
+			worklist.push_back(F);
+	}
+
+	// a definition is in the same module, a declaration via the index
+	void visit(Function *F) {
+		if (F->isIntrinsic())
+			return;
+		if (!F->isDeclaration()) {
+			add(F);
+			return;
+		}
+		if (Function *D = resolve(F->getName()))
+			add(D);
+	}
+
+	void visit(Value *V, SmallPtrSet<Constant *, 16> &seen) {
+		if (Function *F = dyn_cast<Function>(V)) {
+			visit(F);
+			return;
+		}
+		// look through casts and other constant expressions
+		ConstantExpr *CE = dyn_cast<ConstantExpr>(V);
+		if (!CE || !seen.insert(CE).second)
+			return;
+		for (Value *Op : CE->operands())
+			visit(Op, seen);
+	}
+
+public:
+	Closure(LLVMContext &C) : C(C) {}
+
+	bool read_index(const std::string &file) {
+		std::ifstream in(file.c_str());
+		if (!in)
+			return false;
+		std::string sym, bc;
+		while (in >> sym >> bc)
+			index[sym] = bc;
+		return true;
+	}
+
+	Function *resolve(StringRef name) {
+		StringMap<std::string>::iterator it = index.find(name);
+		if (it == index.end())
+			return NULL;
+		Module *M = load(it->second);
+		if (!M)
+			return NULL;
+		Function *F = M->getFunction(name);
+		return F && !F->isDeclaration() ? F : NULL;
+	}
+
+	void compute(Function *Root) {
+		add(Root);
+		while (!worklist.empty()) {
+			Function *F = worklist.back();
+			worklist.pop_back();
+			if (Error E = F->materialize()) {
+				logAllUnhandledErrors(std::move(E), errs(), "rsc-closure: ");
+				continue;
+			}
+			SmallPtrSet<Constant *, 16> seen;
+			for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; ++i)
+				for (Value *Op : i->operands())
+					visit(Op, seen);
+		}
+	}
+
+	/*
+	 * Drop every body outside the closure before linking, so that the
+	 * remaining functions of each file are never read.
+	 */
+	std::unique_ptr<Module> link() {
+		std::unique_ptr<Module> Dst(new Module(TARGET + ".closure", C));
+		Linker L(*Dst);
+
+		for (auto &entry : modules) {
+			std::unique_ptr<Module> &M = entry.second;
+			if (!M)
+				continue;
+			for (Function &F : *M)
+				if (!F.isDeclaration() && !funcs.count(&F))
+					F.deleteBody();
+			if (Error E = M->materializeAll()) {
+				logAllUnhandledErrors(std::move(E), errs(), "rsc-closure: ");
+				return NULL;
+			}
+			if (L.linkInModule(std::move(M)))
+				return NULL;
+		}
+		return Dst;
+	}
+
+	unsigned nr_functions() const { return funcs.size(); }
+	unsigned nr_files() const { return modules.size(); }
+};
+
+int main(int argc, char **argv) {
+	cl::ParseCommandLineOptions(argc, argv, "closure of a function's callees\n");
+
+	LLVMContext C;
+	Closure closure(C);
+	if (!closure.read_index(INDEX)) {
+		errs() << "Cannot open symbol index " << INDEX << "\n";
+		return 1;
+	}
+
+	Function *Root = closure.resolve(TARGET);
+	if (!Root) {
+		errs() << TARGET << " is not defined in " << INDEX << "\n";
+		return 1;
+	}
+
+	closure.compute(Root);
+	errs() << "closure: " << closure.nr_functions() << " functions from "
+	       << closure.nr_files() << " files\n";
+
+	std::unique_ptr<Module> M = closure.link();
+	if (!M) {
+		errs() << "Cannot link the closure of " << TARGET << "\n";
+		return 1;
+	}
+
+	std::string file = OUTPUT.empty() ? TARGET + ".bc" : OUTPUT;
+	std::error_code EC;
+	raw_fd_ostream out(file, EC, sys::fs::F_None);
+	if (EC) {
+		errs() << "Cannot write " << file << ": " << EC.message() << "\n";
+		return 1;
+	}
+	WriteBitcodeToFile(M.get(), out);
+	return 0;
+}
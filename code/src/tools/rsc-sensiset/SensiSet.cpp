@@ -0,0 +1,86 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "MemLog.h"
+#include "Slice.h"
+#include "util.h"
+#include "rsc_CallGraph.h"
+
+using namespace llvm;
+using namespace rsc;
+
+/*
+ * rsc-sensiset computes the sensitive function set like `opt -sensiset`,
+ * but without linking the kernel into one module first: CallGraphPass
+ * runs out-of-core over the bitcode files, loading one file at a time
+ * into a context of its own (see IterativeModulePass). What stays resident
+ * is the function pointer state, one stand-in declaration per function
+ * and the call graph over those stand-ins.
+ *
+ * Stand-ins are named by scope name (see getScopeName()), so static
+ * functions appear in the list as _<file>.<name>.
+ */
+
+static cl::list<std::string>
+FILES(cl::Positional, cl::desc("<bitcode files>"));
+
+static cl::opt<std::string>
+BCLIST("bclist",
+       cl::init(""),
+       cl::desc("A file listing the bitcode files to analyze"));
+
+static cl::opt<std::string>
+OUTPUT("o",
+       cl::init("sensi-list"),
+       cl::desc("Write the sensitive function set to the given file"));
+
+static cl::opt<std::string>
+MEMLOG("mem-log",
+       cl::init(""),
+       cl::desc("Append per-structure memory estimates at each stage to this file"));
+
+int main(int argc, char **argv) {
+	cl::ParseCommandLineOptions(argc, argv, "out-of-core sensitive set\n");
+
+	ModuleFileList files(FILES.begin(), FILES.end());
+	if (!BCLIST.empty()) {
+		std::ifstream in(BCLIST.c_str());
+		if (!in) {
+			errs() << "Cannot open " << BCLIST << "\n";
+			return 1;
+		}
+		std::string file;
+		while (std::getline(in, file))
+			if (!file.empty())
+				files.push_back(file);
+	}
+
+	MemLog memlog;
+	if (!MEMLOG.empty() && !memlog.open(MEMLOG))
+		errs() << "Cannot open memory log " << MEMLOG << "\n";
+
+	GlobalContext ctx;
+	ctx.MemLog = &memlog;
+	CallGraphPass CGP(&ctx);
+	CGP.run(files);
+
+	StringSet<> entries, sleepers;
+	addDefaultAtomicEntries(entries);
+	addDefaultSleepingPrimitives(sleepers);
+	SensitiveSlice slice(entries, sleepers);
+	slice.compute(ctx.CallGraph);
+
+	if (!slice.write(OUTPUT)) {
+		errs() << "Cannot write " << OUTPUT << "\n";
+		return 1;
+	}
+	std::cout << "sensiset: " << slice.size() << " of "
+		  << ctx.CallGraph.nr_functions() << " functions" << std::endl;
+	return 0;
+}
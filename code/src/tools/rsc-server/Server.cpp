@@ -0,0 +1,582 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "CallGraphCSR.h"
+#include "Skeleton.h"
+#include "Slice.h"
+#include "Tabulation.h"
+#include "TrivialLeaf.h"
+#include "util.h"
+#include "rsc_CallGraph.h"
+
+using namespace llvm;
+using namespace rsc;
+
+/*
+ * rsc-server keeps the bitcode of every file, the call graph and the
+ * atomic-state summaries in memory, and answers queries on a Unix domain
+ * socket. Each request is one line, each response one line of JSON:
+ *
+ *   may-sleep <function>      {"function": ..., "may_sleep": true}
+ *   atomic-reach <function>   {"function": ..., "states": [...], "sections": [...]}
+ *   reports                   {"reports": [{"function": ..., "callee": ..., "state": ...}]}
+ *   reload <file.bc>          {"reloaded": ..., "incremental": true,
+ *                              "changed": n, "resummarized": m}
+ *   quit / shutdown
+ *
+ * Files are kept as separate modules, so a reload replaces one module.
+ * The function pointer sets and callees stay resident: unless the file
+ * now defines or takes the address of other functions, only the keys
+ * reached from its constraints are solved again (CallGraphPass::reload),
+ * otherwise the call graph pass runs over all files again. Only functions
+ * whose bodies or callees changed, and their transitive callers, are
+ * summarized again; the summaries of all other functions are restored
+ * from the previous run. Which of them are reached, and the reports, are
+ * derived again from the entries.
+ */
+
+static cl::list<std::string>
+FILES(cl::Positional, cl::desc("<bitcode files>"));
+
+static cl::opt<std::string>
+BCLIST("bclist",
+       cl::init(""),
+       cl::desc("A file listing the bitcode files to load"));
+
+static cl::opt<std::string>
+SOCKET("socket",
+       cl::init("rsc.sock"),
+       cl::desc("Path of the Unix domain socket"));
+
+static cl::opt<std::string>
+INLINELIST("inline-list",
+	   cl::init(""),
+	   cl::desc("A list of helper functions to be treated as having no effect"));
+
+static std::string json_str(StringRef s) {
+	std::string out = "\"";
+	for (char c : s) {
+		switch (c) {
+		case '"':  out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		case '\b': out += "\\b"; break;
+		case '\f': out += "\\f"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+static std::string json_error(const std::string &msg) {
+	return "{\"error\": " + json_str(msg) + "}";
+}
+
+class Server {
+	typedef AtomicTabulation::Fact Fact;
+	typedef CallGraphCSR::FuncId FuncId;
+
+	/*
+	 * A summary of a function, keyed by name across reloads: callees by
+	 * key, in the order of its calls, and sleeping calls by the ordinal of
+	 * their site in the function.
+	 */
+	struct Cached {
+		Fact entry;
+		AtomicTabulation::Summary summary;
+		std::vector<std::string> callees;
+	};
+
+	LLVMContext C;
+	std::vector<std::string> files;
+	StringMap<std::unique_ptr<Module>> modules;
+
+	StringSet<> entry_names, sleepers, inlined;
+
+	std::unique_ptr<GlobalContext> ctx;
+	std::unique_ptr<CallGraphPass> cgp;     // kept for reload()
+	CallGraphCSR *graph;            // ctx->CallGraph
+	std::unique_ptr<SensitiveSlice> slice;
+	TrivialLeaves trivial;
+	std::unique_ptr<Skeletons> skeletons;
+	std::unique_ptr<AtomicTabulation> tab;
+
+	StringMap<FuncId> ids;
+	StringMap<std::vector<Cached>> cache;
+
+	// static functions of different files may share a name
+	static std::string key_of(const Function *F) {
+		if (F->hasLocalLinkage())
+			return F->getParent()->getModuleIdentifier() + ":" + F->getName().str();
+		return F->getName().str();
+	}
+
+	bool load(const std::string &file) {
+		SMDiagnostic Err;
+		std::unique_ptr<Module> M = parseIRFile(file, Err, C);
+		if (!M) {
+			Err.print("rsc-server", errs());
+			return false;
+		}
+		modules[file] = std::move(M);
+		return true;
+	}
+
+	ModuleList module_list() {
+		ModuleList list;
+		for (const std::string &file : files)
+			list.push_back(std::make_pair(modules[file].get(),
+						      StringRef(file)));
+		return list;
+	}
+
+	// indirect calls resolved over all files, declarations by name
+	void build_graph() {
+		cgp.reset();
+		ctx.reset(new GlobalContext());
+		cgp.reset(new CallGraphPass(ctx.get()));
+		cgp->enableReload();
+		ModuleList list = module_list();
+		cgp->run(list);
+		derive();
+	}
+
+	// everything computed from the call graph
+	void derive() {
+		graph = &ctx->CallGraph;
+
+		ids.clear();
+		for (FuncId f = 0; f < graph->nr_functions(); ++f) {
+			Function *F = graph->function(f);
+			if (!F->isDeclaration())
+				ids[key_of(F)] = f;
+		}
+
+		slice.reset(new SensitiveSlice(entry_names, sleepers));
+		slice->compute(*graph);
+		trivial.compute(*graph, inlined, sleepers);
+		skeletons.reset(new Skeletons(*graph, sleepers, &trivial));
+	}
+
+	/*
+	 * Summarize all functions. Functions not marked in dirty are
+	 * restored from the cache instead of being explored again.
+	 */
+	void summarize(const BitVector *dirty) {
+		tab.reset(new AtomicTabulation(*skeletons));
+
+		if (dirty) {
+			for (FuncId f = 0; f < graph->nr_functions(); ++f) {
+				Function *F = graph->function(f);
+				if (F->isDeclaration() || dirty->test(f))
+					continue;
+				auto it = cache.find(key_of(F));
+				if (it == cache.end())
+					continue;
+				restore(f, it->second);
+			}
+		}
+
+		for (FuncId f = 0; f < graph->nr_functions(); ++f)
+			tab->add_entry(f);
+		tab->solve();
+
+		snapshot();
+	}
+
+	// a summary whose callee is gone or site out of range is dropped
+	void restore(FuncId f, const std::vector<Cached> &list) {
+		CallGraphCSR::Range sites = graph->sites_in(f);
+		for (const Cached &c : list) {
+			AtomicTabulation::Summary S = c.summary;
+			bool valid = true;
+			for (unsigned i = 0; i < S.calls.size() && valid; ++i) {
+				S.calls[i].caller = f;
+				S.calls[i].callee = lookup(c.callees[i]);
+				valid = S.calls[i].callee != CallGraphCSR::NONE;
+			}
+			for (AtomicTabulation::Sleep &L : S.sleeps) {
+				if (L.site >= sites.size()) {
+					valid = false;
+					break;
+				}
+				L.site = sites.begin()[L.site];
+			}
+			if (valid)
+				tab->add_summary(f, c.entry, S);
+		}
+	}
+
+	// the summaries reached in this run, which replace the cache
+	void snapshot() {
+		std::vector<std::string> keys(graph->nr_functions());
+		std::vector<std::vector<Cached>*> lists(graph->nr_functions());
+		StringMap<std::vector<Cached>> next;
+
+		for (FuncId f = 0; f < graph->nr_functions(); ++f) {
+			Function *F = graph->function(f);
+			if (F->isDeclaration())
+				continue;
+			keys[f] = key_of(F);
+			lists[f] = &next[keys[f]];
+
+			CallGraphCSR::Range sites = graph->sites_in(f);
+			unsigned mask = tab->entries(f);
+			for (unsigned d = 0; d < atomic::NR_FACTS; ++d) {
+				if (!(mask & (1U << d)))
+					continue;
+				Cached c;
+				c.entry = d;
+				c.summary.exits = tab->exits(f, d);
+				for (AtomicTabulation::Sleep L : tab->sleeps(f, d)) {
+					L.site = std::lower_bound(sites.begin(), sites.end(), L.site)
+						- sites.begin();
+					c.summary.sleeps.push_back(L);
+				}
+				lists[f]->push_back(c);
+			}
+		}
+
+		std::vector<AtomicTabulation::CallEdge> edges;
+		tab->callers(edges);
+		for (const AtomicTabulation::CallEdge &E : edges) {
+			for (Cached &c : *lists[E.caller]) {
+				if (c.entry != E.entry)
+					continue;
+				c.summary.calls.push_back(E);
+				c.callees.push_back(keys[E.callee]);
+				break;
+			}
+		}
+
+		cache.swap(next);
+	}
+
+	FuncId lookup(StringRef name) const {
+		auto it = ids.find(name);
+		return it == ids.end() ? CallGraphCSR::NONE : it->second;
+	}
+
+	// the callees of each site of f, which other files may change
+	std::string callees_of(FuncId f) const {
+		std::string s;
+		for (CallGraphCSR::SiteId site : graph->sites_in(f)) {
+			std::vector<std::string> names;
+			for (FuncId t : graph->targets(site)) {
+				Function *T = graph->function(t);
+				names.push_back((T->isDeclaration() ? "-" : "+") + key_of(T));
+			}
+			std::sort(names.begin(), names.end());
+			for (const std::string &name : names)
+				s += name + ",";
+			s += ";";
+		}
+		return s;
+	}
+
+	std::string reload(const std::string &file) {
+		StringMap<std::unique_ptr<Module>>::iterator old = modules.find(file);
+		if (old == modules.end())
+			return json_error("not loaded: " + file);
+
+		SMDiagnostic Err;
+		std::unique_ptr<Module> M = parseIRFile(file, Err, C);
+		if (!M)
+			return json_error("cannot parse " + file);
+
+		// functions added, removed or with a different body
+		StringSet<> changed;
+		for (Function &F : *M) {
+			if (F.isDeclaration())
+				continue;
+			Function *Old = old->second->getFunction(F.getName());
+			if (!Old || Old->isDeclaration() || !sameBody(Old, &F))
+				changed.insert(key_of(&F));
+		}
+		for (Function &F : *old->second) {
+			if (F.isDeclaration())
+				continue;
+			Function *New = M->getFunction(F.getName());
+			if (!New || New->isDeclaration())
+				changed.insert(key_of(&F));
+		}
+
+		StringMap<std::string> callees;
+		for (FuncId f = 0; f < graph->nr_functions(); ++f)
+			if (!graph->function(f)->isDeclaration())
+				callees[key_of(graph->function(f))] = callees_of(f);
+
+		tab.reset();
+		skeletons.reset();
+		slice.reset();
+		graph = NULL;
+
+		// the old module goes once the pass has let go of it
+		ModuleList list = module_list();
+		for (auto &entry : list)
+			if (entry.first == old->second.get())
+				entry.first = M.get();
+		bool incremental = cgp->reload(old->second.get(), M.get(), list);
+		if (!incremental) {
+			cgp.reset();
+			ctx.reset();
+		}
+		old->second = std::move(M);
+		if (incremental)
+			derive();
+		else
+			build_graph();
+
+		for (FuncId f = 0; f < graph->nr_functions(); ++f) {
+			Function *F = graph->function(f);
+			if (F->isDeclaration())
+				continue;
+			auto it = callees.find(key_of(F));
+			if (it != callees.end() && it->second != callees_of(f))
+				changed.insert(it->getKey());
+		}
+
+		// summaries depend on callees, so callers are redone as well
+		BitVector dirty(graph->nr_functions());
+		std::vector<FuncId> queue;
+		for (auto &entry : changed) {
+			FuncId f = lookup(entry.getKey());
+			if (f != CallGraphCSR::NONE && !dirty.test(f)) {
+				dirty.set(f);
+				queue.push_back(f);
+			}
+		}
+		for (unsigned q = 0; q < queue.size(); ++q) {
+			for (FuncId g : graph->callers(queue[q])) {
+				if (!dirty.test(g)) {
+					dirty.set(g);
+					queue.push_back(g);
+				}
+			}
+		}
+
+		summarize(&dirty);
+
+		std::ostringstream os;
+		os << "{\"reloaded\": " << json_str(file)
+		   << ", \"incremental\": " << (incremental ? "true" : "false")
+		   << ", \"changed\": " << changed.size()
+		   << ", \"resummarized\": " << dirty.count() << "}";
+		return os.str();
+	}
+
+	std::string may_sleep(const std::string &name) {
+		FuncId f = lookup(name);
+		if (f == CallGraphCSR::NONE)
+			return json_error("unknown function " + name);
+		bool sleeps = sleepers.count(name) || slice->may_sleep(graph->function(f));
+		return "{\"function\": " + json_str(name) + ", \"may_sleep\": "
+			+ (sleeps ? "true" : "false") + "}";
+	}
+
+	/*
+	 * The atomic states name may be entered in, and for each the function
+	 * where the atomic section starts on the shortest chain reaching it.
+	 */
+	std::string atomic_reach(const std::string &name) {
+		FuncId f = lookup(name);
+		if (f == CallGraphCSR::NONE)
+			return json_error("unknown function " + name);
+
+		std::string states, sections;
+		StringSet<> seen;
+		unsigned mask = tab->entries(f);
+		for (unsigned d = 0; d < atomic::NR_FACTS; ++d) {
+			if (!(mask & (1U << d)) || !atomic::in_atomic(d))
+				continue;
+			states += (states.empty() ? "" : ", ") + json_str(atomic::to_string(d));
+
+			std::vector<AtomicTabulation::Step> chain;
+			if (!tab->chain_to(f, d, chain))
+				continue;
+			for (auto S = chain.rbegin(); S != chain.rend(); ++S) {
+				if (atomic::in_atomic(S->entry))
+					continue;
+				StringRef fn = getFunctionName(graph->function(S->func));
+				if (seen.insert(fn).second)
+					sections += (sections.empty() ? "" : ", ") + json_str(fn);
+				break;
+			}
+		}
+
+		return "{\"function\": " + json_str(name) + ", \"states\": [" + states
+			+ "], \"sections\": [" + sections + "]}";
+	}
+
+	std::string reports() {
+		std::string out;
+		for (const AtomicTabulation::Report &R : tab->reports()) {
+			StringRef callee = "<indirect>";
+			for (FuncId t : graph->targets(R.site)) {
+				StringRef name = getFunctionName(graph->function(t));
+				if (sleepers.count(name)) {
+					callee = name;
+					break;
+				}
+			}
+			out += out.empty() ? "" : ", ";
+			out += "{\"function\": " + json_str(getFunctionName(graph->function(R.func)))
+				+ ", \"callee\": " + json_str(callee)
+				+ ", \"state\": " + json_str(atomic::to_string(R.fact)) + "}";
+		}
+		return "{\"reports\": [" + out + "]}";
+	}
+
+public:
+	Server() : graph(NULL) {}
+
+	bool init(const std::vector<std::string> &list) {
+		addDefaultAtomicEntries(entry_names);
+		addDefaultSleepingPrimitives(sleepers);
+		if (!INLINELIST.empty() && !readFunctionList(INLINELIST, inlined))
+			errs() << "Cannot open inline list " << INLINELIST << "\n";
+
+		for (const std::string &file : list) {
+			if (modules.count(file))
+				continue;
+			if (!load(file))
+				return false;
+			files.push_back(file);
+		}
+
+		build_graph();
+		summarize(NULL);
+		errs() << "rsc-server: " << files.size() << " files, "
+		       << graph->nr_functions() << " functions, "
+		       << tab->reports().size() << " reports\n";
+		return true;
+	}
+
+	// one request line in, one JSON line out
+	std::string handle(const std::string &line) {
+		std::istringstream is(line);
+		std::string cmd, arg;
+		is >> cmd >> arg;
+
+		if (cmd == "may-sleep")
+			return may_sleep(arg);
+		if (cmd == "atomic-reach")
+			return atomic_reach(arg);
+		if (cmd == "reports")
+			return reports();
+		if (cmd == "reload")
+			return reload(arg);
+		return json_error("unknown command " + cmd);
+	}
+};
+
+static bool write_line(int fd, const std::string &s) {
+	std::string out = s + "\n";
+	for (size_t done = 0; done < out.size(); ) {
+		ssize_t n = write(fd, out.data() + done, out.size() - done);
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+// serve one client until it quits; returns false on shutdown
+static bool serve(Server &S, int fd) {
+	std::string buf;
+	char chunk[4096];
+
+	for (;;) {
+		size_t nl;
+		while ((nl = buf.find('\n')) != std::string::npos) {
+			std::string line = buf.substr(0, nl);
+			buf.erase(0, nl + 1);
+			if (line == "quit")
+				return true;
+			if (line == "shutdown")
+				return false;
+			if (!write_line(fd, S.handle(line)))
+				return true;
+		}
+		ssize_t n = read(fd, chunk, sizeof(chunk));
+		if (n <= 0)
+			return true;
+		buf.append(chunk, n);
+	}
+}
+
+int main(int argc, char **argv) {
+	cl::ParseCommandLineOptions(argc, argv, "resident RSC query server\n");
+
+	std::vector<std::string> list(FILES.begin(), FILES.end());
+	if (!BCLIST.empty()) {
+		std::ifstream in(BCLIST.c_str());
+		if (!in) {
+			errs() << "Cannot open " << BCLIST << "\n";
+			return 1;
+		}
+		std::string file;
+		while (std::getline(in, file))
+			if (!file.empty())
+				list.push_back(file);
+	}
+
+	Server S;
+	if (!S.init(list))
+		return 1;
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCKET.c_str(), sizeof(addr.sun_path) - 1);
+	unlink(SOCKET.c_str());
+	if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(sock, 8) < 0) {
+		errs() << "Cannot listen on " << SOCKET << "\n";
+		return 1;
+	}
+
+	for (bool running = true; running; ) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		running = serve(S, fd);
+		close(fd);
+	}
+
+	close(sock);
+	unlink(SOCKET.c_str());
+	return 0;
+}
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Pass.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "util.h"
+#include "MemLog.h"
+#include "Trace.h"
+#include "Skeleton.h"
+#include "Slice.h"
+#include "CallGraphCSR.h"
+#include "Stats.h"
+#include "Tabulation.h"
+#include "TrivialLeaf.h"
+#include "rsc_CallGraph.h"
+
+using namespace llvm;
+using namespace rsc;
+
+// shared with the rsc pass
+extern cl::opt<int> MaxPath;
+extern cl::opt<bool> O_PROGRESS;
+extern cl::opt<std::string> INLINELIST;
+extern cl::opt<std::string> MEMLOG;
+extern cl::opt<std::string> TRACE;
+extern cl::opt<unsigned> FUNC_STEP_BUDGET;
+extern cl::opt<double> FUNC_TIME_BUDGET;
+extern cl::opt<unsigned> MAX_SUMMARIES;
+
+/*
+ * Run every stage of the rsc pipeline on a module and dump what each of
+ * them costs as JSON on stdout, for `analyze.sh count`:
+ *
+ *   counters    sizes of the module and of each stage's results
+ *   histograms  distributions that hide a blow-up behind an average
+ *   times       wall time of each stage, in seconds
+ *
+ * Indirect calls are resolved by CallGraphPass, as in the rsc pass; the
+ * function pointer stats are the sizes of its FuncPtrs sets and the
+ * number of targets each indirect call site ends up with.
+ */
+class Count : public ModulePass {
+	StringSet<> entries;
+	StringSet<> sleepers;
+	StringSet<> inlinelist;
+
+	MemLog memlog;
+	mem::Snapshot sizes;              // of the stages done so far
+
+	void progress(StringRef stage) {
+		if (O_PROGRESS)
+			errs() << "count: " << stage << "\n";
+	}
+
+	void log_memory(StringRef stage) {
+		memlog.record(stage, sizes);
+	}
+
+	void count_calls(Module &M, const GlobalContext &ctx) {
+		for (Function &F : M) {
+			if (F.isDeclaration())
+				stats::add("functions.declared");
+			else
+				stats::add("functions.defined");
+		}
+
+		stats::add("fp.keys", ctx.FuncPtrs.size());
+		for (auto &P : ctx.FuncPtrs)
+			stats::sample("fp.set_size", P.second.size());
+		stats::add("fp.types", ctx.TypeFuncs.size());
+		stats::add("fp.sets", ctx.FuncSets.size());
+
+		const CallGraphCSR &graph = ctx.CallGraph;
+		for (CallGraphCSR::SiteId s = 0; s < graph.nr_sites(); ++s) {
+			CallInst *CI = graph.site(s);
+			stats::add("sites");
+			if (CI->getCalledFunction())
+				continue;
+			if (isa<InlineAsm>(CI->getCalledValue())) {
+				stats::add("sites.asm");
+				continue;
+			}
+			stats::add("sites.indirect");
+			unsigned n = graph.targets(s).size();
+			stats::sample("fp.candidates", n);
+			if (!n)
+				stats::add("sites.unresolved");
+		}
+	}
+
+	/*
+	 * The number of acyclic paths from the entry to an exit of a skeleton,
+	 * i.e. what the path enumeration would walk with back edges cut; the
+	 * blocks bypassed by the skeleton do not change it. Counting stops at
+	 * limit.
+	 */
+	static uint64_t acyclic_paths(const Skeleton &S, uint64_t limit) {
+		unsigned n = S.nr_blocks();
+		std::vector<unsigned> rpo;
+		std::vector<bool> seen(n);
+		std::vector<std::pair<unsigned, unsigned>> stack;   // block, next succ
+		seen[0] = true;
+		stack.push_back(std::make_pair(0U, 0U));
+		while (!stack.empty()) {
+			unsigned b = stack.back().first;
+			CallGraphCSR::Range succs = S.successors(b);
+			if (stack.back().second == succs.size()) {
+				rpo.push_back(b);
+				stack.pop_back();
+				continue;
+			}
+			unsigned s = succs.begin()[stack.back().second++];
+			if (!seen[s]) {
+				seen[s] = true;
+				stack.push_back(std::make_pair(s, 0U));
+			}
+		}
+		std::reverse(rpo.begin(), rpo.end());
+		std::vector<unsigned> order(n);
+		for (unsigned i = 0; i < rpo.size(); ++i)
+			order[rpo[i]] = i;
+
+		std::vector<uint64_t> paths(n);
+		uint64_t total = 0;
+		paths[0] = 1;
+		for (unsigned b : rpo) {
+			uint64_t k = paths[b];
+			CallGraphCSR::Range succs = S.successors(b);
+			if (succs.empty())
+				total = std::min(total + k, limit);
+			for (unsigned s : succs) {
+				if (order[s] <= order[b])
+					continue;               // back edge
+				paths[s] = std::min(paths[s] + k, limit);
+			}
+		}
+		return total;
+	}
+
+	void count_paths(Skeletons &skeletons, const SensitiveSlice &slice) {
+		const CallGraphCSR &G = skeletons.call_graph();
+		uint64_t limit = MaxPath + 1;
+		for (CallGraphCSR::FuncId f = 0; f < G.nr_functions(); ++f) {
+			if (!skeletons.has_body(f) || !slice.contains(G.function(f)))
+				continue;
+			uint64_t n = acyclic_paths(skeletons.of(f), limit);
+			stats::sample("paths.per_function", n);
+			if (n == limit) {
+				stats::add("paths.capped_functions");
+				n = MaxPath;
+			}
+			stats::add("paths.enumerated", n);
+		}
+	}
+
+	// extracted once, for every function the later stages look at
+	void extract_skeletons(Skeletons &skeletons, const SensitiveSlice &slice) {
+		const CallGraphCSR &G = skeletons.call_graph();
+		for (CallGraphCSR::FuncId f = 0; f < G.nr_functions(); ++f) {
+			if (!skeletons.has_body(f) || !slice.contains(G.function(f)))
+				continue;
+			const Skeleton &S = skeletons.of(f);
+			stats::add("skeleton.functions");
+			stats::add("skeleton.ir_blocks", S.nr_ir_blocks);
+			stats::add("skeleton.blocks", S.nr_blocks());
+			stats::add("skeleton.events", S.events.size() - S.nr_blocks());
+			stats::sample("skeleton.blocks_per_function", S.nr_blocks());
+		}
+	}
+
+public:
+	static char ID;
+
+	Count() : ModulePass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AU.setPreservesAll();
+	}
+
+	virtual bool runOnModule(Module &M) {
+		addDefaultAtomicEntries(entries);
+		addDefaultSleepingPrimitives(sleepers);
+		if (!INLINELIST.empty() && !readFunctionList(INLINELIST, inlinelist))
+			errs() << "Cannot open inline list " << INLINELIST << "\n";
+		if (!MEMLOG.empty() && !memlog.open(MEMLOG))
+			errs() << "Cannot open memory log " << MEMLOG << "\n";
+		if (!TRACE.empty() && !trace::start(TRACE))
+			errs() << "Cannot open trace " << TRACE << "\n";
+
+		progress("call graph");
+		GlobalContext ctx;
+		ctx.MemLog = &memlog;
+		{
+			stats::StageTimer T("callgraph");
+			ModuleList modules(1, std::make_pair(&M,
+					StringRef(M.getModuleIdentifier())));
+			CallGraphPass CGP(&ctx);
+			CGP.run(modules);
+		}
+		const CallGraphCSR &graph = ctx.CallGraph;
+
+		progress("call sites");
+		{
+			stats::StageTimer T("module_scan");
+			count_calls(M, ctx);
+		}
+		ctx.memory(sizes);
+		log_memory("callgraph");
+		stats::add("csr.edges", graph.nr_edges());
+		for (CallGraphCSR::FuncId f = 0; f < graph.nr_functions(); ++f) {
+			stats::sample("csr.callees", graph.callees(f).size());
+			stats::sample("csr.callers", graph.callers(f).size());
+		}
+
+		progress("trivial leaves");
+		TrivialLeaves trivial;
+		{
+			stats::StageTimer T("trivial_leaves");
+			trivial.compute(graph, inlinelist, sleepers);
+		}
+		stats::add("trivial_leaves", trivial.size());
+		trivial.memory(sizes);
+		log_memory("trivial_leaves");
+
+		progress("slice");
+		SensitiveSlice slice(entries, sleepers);
+		{
+			stats::StageTimer T("slice");
+			slice.compute(graph);
+		}
+		stats::add("slice.functions", slice.size());
+		slice.memory(sizes);
+		log_memory("slice");
+
+		progress("skeletons");
+		Skeletons skeletons(graph, sleepers, &trivial);
+		{
+			stats::StageTimer T("skeletons");
+			extract_skeletons(skeletons, slice);
+		}
+		skeletons.memory(sizes);
+		log_memory("skeletons");
+
+		progress("paths");
+		{
+			stats::StageTimer T("paths");
+			count_paths(skeletons, slice);
+		}
+
+		progress("tabulation");
+		AtomicTabulation tabulation(skeletons);
+		AtomicTabulation::Budget budget;
+		budget.steps = FUNC_STEP_BUDGET;
+		budget.seconds = FUNC_TIME_BUDGET;
+		tabulation.set_budget(budget);
+		tabulation.set_summary_cap(MAX_SUMMARIES);
+		{
+			stats::StageTimer T("tabulation");
+			for (CallGraphCSR::FuncId f = 0; f < graph.nr_functions(); ++f) {
+				Function *F = graph.function(f);
+				if (!trivial.contains(f) && slice.contains(F))
+					tabulation.add_entry(f);
+			}
+			tabulation.solve();
+		}
+		stats::add("fixpoint.iterations", tabulation.nr_iterations());
+		stats::add("tabulation.path_edges", tabulation.nr_path_edges());
+		stats::add("tabulation.summaries", tabulation.nr_summaries());
+		stats::add("tabulation.widened", tabulation.nr_widened());
+		stats::add("reports", tabulation.reports().size());
+		stats::declare("tabulation.degraded");
+		for (const AtomicTabulation::Degraded &D : tabulation.degraded()) {
+			static const char *const reasons[] = {
+				"tabulation.degraded.steps",
+				"tabulation.degraded.time",
+			};
+			stats::add("tabulation.degraded");
+			stats::add(reasons[D.reason]);
+		}
+		tabulation.memory(sizes);
+		log_memory("tabulation");
+
+		progress("witnesses");
+		{
+			stats::StageTimer T("witness");
+			std::vector<AtomicTabulation::Step> chain;
+			for (const AtomicTabulation::Report &R : tabulation.reports()) {
+				chain.clear();
+				if (tabulation.witness(R, chain))
+					stats::sample("witness.length", chain.size());
+			}
+		}
+
+		log_memory("witness");
+		stats::add("peak_rss_kb", mem::peak_rss());
+		stats::print_json(outs());
+		trace::finish();
+		return false;
+	}
+
+	virtual void print(raw_ostream &O, const Module *M) const {}
+};
+
+char Count::ID = 0;
+
+static RegisterPass<Count> X("count", "Dump statistics of every rsc stage as JSON",
+			     false /* Only looks at CFG */,
+			     true /* Analysis Pass */);
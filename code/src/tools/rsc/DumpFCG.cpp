@@ -0,0 +1,68 @@
+#include <iostream>
+
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Function.h>
+
+#include "util.h"
+
+using namespace llvm;
+using namespace rsc;
+
+/*
+ * Dump the direct function-level call graph of a module, used by
+ * scripts/bcdep/fnpart.py to split large file-level SCCs into units.
+ *
+ *   F <function> <estimated cost>
+ *   E <caller> <callee>
+ *
+ * Only functions defined in the module are listed. The cost estimate is the
+ * number of IR instructions.
+ */
+class DumpFCG : public ModulePass {
+public:
+	static char ID;
+
+	DumpFCG() : ModulePass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AU.addRequired<CallGraphWrapperPass>();
+		AU.setPreservesAll();
+	}
+
+	virtual bool runOnModule(Module &M) {
+		CallGraph &CG = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+
+		for (Function &F : M) {
+			if (F.empty())
+				continue;
+			unsigned cost = 0;
+			for (BasicBlock &B : F)
+				cost += B.size();
+			std::cout << "F " << getFunctionName(&F).str() << " " << cost << "\n";
+		}
+
+		for (Function &F : M) {
+			if (F.empty())
+				continue;
+			for (auto &CR : *CG[&F]) {
+				Function *Callee = CR.second->getFunction();
+				if (!Callee || Callee->empty())
+					continue;
+				std::cout << "E " << getFunctionName(&F).str() << " "
+					  << getFunctionName(Callee).str() << "\n";
+			}
+		}
+		std::cout.flush();
+		return false;
+	}
+
+	virtual void print(raw_ostream &O, const Module *M) const {}
+};
+
+char DumpFCG::ID = 0;
+
+static RegisterPass<DumpFCG> X("fcg", "Dump the function-level call graph",
+			       false /* Only looks at CFG */,
+			       true /* Analysis Pass */);
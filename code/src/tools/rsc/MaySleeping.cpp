@@ -2,6 +2,7 @@
 #include <cstring>
 #include <list>
 #include <algorithm>
+#include <memory>
 
 #include <boost/regex.hpp>
 
@@ -14,6 +15,10 @@
 #include "llvm/Support/Casting.h"
 
 #include "util.h"
+#include "Slice.h"
+#include "Skeleton.h"
+#include "TrivialLeaf.h"
+#include "rsc_CallGraph.h"
 
 using namespace llvm;
 using namespace rsc;
@@ -25,30 +30,48 @@ class MaySleeping : public FunctionPass {
 
 private:
 
-	std::list<std::string> may_sleeping_primitive;
+	// the same primitives the rsc pass and the slice look for
+	StringSet<> may_sleeping_primitive;
+
+	// the call graph resolves indirect calls, the skeletons keep only
+	// the calls that may sleep or reach a body
+	std::unique_ptr<GlobalContext> ctx;
+	std::unique_ptr<Skeletons> skeletons;
 
 public:
 	static char ID;
 	MaySleeping() : FunctionPass(ID) {}
 
-	virtual bool doInitialization(Function &F) {
-		may_sleeping_primitive.push_back("spin_lock_irqsave");
+	virtual bool doInitialization(Module &M) {
+		addDefaultSleepingPrimitives(may_sleeping_primitive);
+
+		ctx.reset(new GlobalContext());
+		ModuleList modules(1, std::make_pair(&M,
+				StringRef(M.getModuleIdentifier())));
+		CallGraphPass CGP(ctx.get());
+		CGP.run(modules);
+		skeletons.reset(new Skeletons(ctx->CallGraph,
+					      may_sleeping_primitive));
 		return false;
 	}
 
 	virtual bool runOnFunction(Function &F) {
-		for (BasicBlock &B : F) {
-			for (Instruction &I: B) {
-				if (auto *CI = dyn_cast<CallInst>(&I)) {
-					StringRef cnt_fn = rsc::getFunctionName(CI->getCalledFunction());
-					std::string cnt_fn_name_str = cnt_fn.str();
-					std::list<std::string>::iterator it = find(may_sleeping_primitive.begin(), 
-										may_sleeping_primitive.end(), cnt_fn_name_str);
-					if (it != may_sleeping_primitive.end()) {
-						std::cout << cnt_fn_name_str << std::endl;
-					}
-				}
-			}
+		// nothing to find in a function without calls
+		if (isTrivialLeaf(F))
+			return false;
+		const CallGraphCSR &graph = skeletons->call_graph();
+		CallGraphCSR::FuncId f = graph.id(&F);
+		if (!skeletons->has_body(f))
+			return false;
+		// a sleep event is a site of sleeping primitives only, a call
+		// event may have one among its alternatives
+		for (const Skeleton::Event &E : skeletons->of(f).events) {
+			if (E.kind != Skeleton::EV_SLEEP && E.kind != Skeleton::EV_CALL)
+				continue;
+			for (CallGraphCSR::FuncId t : graph.targets(E.arg))
+				if (skeletons->sleeps(t))
+					std::cout << getFunctionName(graph.function(t)).str()
+						  << std::endl;
 		}
 		return false;
 	}
@@ -4,11 +4,14 @@
 #include <string>
 #include <list>
 #include <algorithm>
+#include <memory>
 
 #include <boost/regex.hpp>
 
 #include <llvm/Analysis/CallGraph.h>
 #include <llvm/Analysis/CallGraphSCCPass.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Pass.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Constants.h>
@@ -20,14 +23,21 @@
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/CommandLine.h>
-#include <llvm/Support/TimeValue.h>
 
 #include "util.h"
+#include "MemLog.h"
+#include "Trace.h"
+#include "Skeleton.h"
+#include "Slice.h"
+#include "CallGraphCSR.h"
+#include "Tabulation.h"
+#include "TrivialLeaf.h"
+#include "rsc_CallGraph.h"
 
 using namespace llvm;
 using namespace rsc;
 
- static cl::opt<int>
+cl::opt<int>
 MaxPath("max-path-per-func",
 	cl::init(100),
 	cl::desc("Maximum number of paths to be enumerated in a function"));
@@ -42,7 +52,7 @@ O_TEST("o-test",
        cl::init(false),
        cl::desc("Print final summaries for test"));
 
-static cl::opt<bool>
+cl::opt<bool>
 O_PROGRESS("o-progress",
 	   cl::init(false),
 	   cl::desc("Print progress to stdout"));
@@ -72,6 +82,67 @@ SENSILIST("sensilist",
 	  cl::init(""),
 	  cl::desc("A list of functions that should be analyzed"));
 
+// opt-in: the slice drops any path it cannot see, so it is only as sound
+// as the call graph's indirect edges and its view of lock wrappers (see
+// Slice.h)
+static cl::opt<bool>
+SLICE("slice",
+      cl::init(false),
+      cl::desc("Only analyze functions on a call path from an atomic entry to a sleeping primitive"));
+
+cl::opt<std::string>
+INLINELIST("inline-list",
+	   cl::init(""),
+	   cl::desc("A list of helper functions to be treated as having no effect"));
+
+static cl::opt<bool>
+TABULATE("tabulate",
+	 cl::init(true),
+	 cl::desc("Propagate the atomic state context-sensitively with per-(function, state) summaries"));
+
+cl::opt<std::string>
+MEMLOG("mem-log",
+       cl::init(""),
+       cl::desc("Append the sizes of the analysis structures and the peak RSS at each stage to the given file, one JSON object per line"));
+
+static cl::opt<bool>
+MEMLOG_SCC("mem-log-scc",
+	   cl::init(false),
+	   cl::desc("Also log memory after each analyzed SCC"));
+
+cl::opt<std::string>
+TRACE("trace",
+      cl::init(""),
+      cl::desc("Write a Chrome trace-format timeline of the stages, SCCs and functions to the given file"));
+
+cl::opt<unsigned>
+FUNC_STEP_BUDGET("func-step-budget",
+		 cl::init(0),
+		 cl::desc("Path edges a function may process before it is analyzed flow-insensitively (0 for no limit)"));
+
+cl::opt<double>
+FUNC_TIME_BUDGET("func-time-budget",
+		 cl::init(0),
+		 cl::desc("Seconds a function may take before it is analyzed flow-insensitively (0 for no limit)"));
+
+cl::opt<unsigned>
+MAX_SUMMARIES("max-summaries-per-func",
+	      cl::init(0),
+	      cl::desc("Summaries a function may have before calls entering it in new states reuse or widen existing ones (0 for no limit)"));
+
+static cl::opt<std::string>
+DEGRADED_LIST("degraded-list",
+	      cl::init(""),
+	      cl::desc("Write the functions that ran out of budget, and why, to the given file"));
+
+static const char *exhausted_name(AtomicTabulation::Exhausted reason) {
+	switch (reason) {
+	case AtomicTabulation::OUT_OF_STEPS:   return "steps";
+	case AtomicTabulation::OUT_OF_TIME:    return "time";
+	}
+	return "";
+}
+
 class RSC : public CallGraphSCCPass {
 
 	int progress, total;
@@ -80,13 +151,43 @@ class RSC : public CallGraphSCCPass {
 
 	bool single_fn_mode;
 
-	std::list<std::string> blacklist;
-	std::list<std::string> sensilist;
+	StringSet<> blacklist;
+	StringSet<> sensilist;
 
-	std::list<std::string> enter_atomic_context_functions;
+	StringSet<> enter_atomic_context_functions;
+	StringSet<> sleeping_functions;
+	StringSet<> inlinelist;
+
+	// name lists resolved against the module
+	DenseSet<const Function*> blacklisted;
+	DenseSet<const Function*> sensitive;
+	std::unique_ptr<GlobalContext> ctx;
+	CallGraphCSR *graph;            // ctx->CallGraph, with indirect calls
+	std::unique_ptr<SensitiveSlice> slice;
+	TrivialLeaves trivial;
+	std::unique_ptr<Skeletons> skeletons;
+	std::unique_ptr<AtomicTabulation> tabulation;
 
 	int ipp_id;
 
+	MemLog memlog;
+
+	void log_memory(StringRef stage, StringRef scc = "") {
+		if (!memlog.is_open())
+			return;
+		mem::Snapshot S;
+		if (ctx)
+			ctx->memory(S);
+		trivial.memory(S);
+		if (slice)
+			slice->memory(S);
+		if (skeletons)
+			skeletons->memory(S);
+		if (tabulation)
+			tabulation->memory(S);
+		memlog.record(stage, S, scc);
+	}
+
 	void run_on_function(CallGraphNode *N, Function &F) {
 		int nr_branches = 0;
 		//Summary *summary = NULL;
@@ -95,29 +196,129 @@ class RSC : public CallGraphSCCPass {
 		int paths = 0, subcases = 0;
 
 		std::cout << fn.str() << std::endl;
-			
-		for (BasicBlock &B : F) {
-	        for (Instruction &I: B) {
-				if (auto *CI = dyn_cast<CallInst>(&I)) {
-					StringRef cnt_fn = getFunctionName(CI->getCalledFunction());
-					std::string cnt_fn_name_str = cnt_fn.str();
-					std::list<std::string>::iterator it = find(enter_atomic_context_functions.begin(), 
-						enter_atomic_context_functions.end(), cnt_fn_name_str);
-					if (it != enter_atomic_context_functions.end()) {
-						//means fn is a function that can enter atomic context
-						//do something
-					}
-				}
+
+		// the skeleton holds every call that matters, no need to walk
+		// the IR; entering the atomic context is an effect event, or a
+		// target of a call of alternatives
+		const unsigned enter = atomic::E_IRQ_OFF | atomic::E_PREEMPT_OFF
+			| atomic::E_LOCK;
+		CallGraphCSR::FuncId f = graph->id(&F);
+		if (!skeletons->has_body(f))
+			return;
+		for (const Skeleton::Event &E : skeletons->of(f).events) {
+			bool enters = E.kind == Skeleton::EV_EFFECT && (E.arg & enter);
+			if (E.kind == Skeleton::EV_CALL)
+				for (CallGraphCSR::FuncId t : graph->targets(E.arg))
+					if (skeletons->effect(t) & enter)
+						enters = true;
+			if (enters) {
+				//means fn is a function that can enter atomic context
+				//do something
 			}
 		}
 	}
 
+	// every analyzed function is an entry in the non-atomic state
+	void tabulate() {
+		trace::Span S("tabulation");
+		tabulation.reset(new AtomicTabulation(*skeletons));
+		AtomicTabulation::Budget B;
+		B.steps = FUNC_STEP_BUDGET;
+		B.seconds = FUNC_TIME_BUDGET;
+		tabulation->set_budget(B);
+		tabulation->set_summary_cap(MAX_SUMMARIES);
+		for (CallGraphCSR::FuncId f = 0; f < graph->nr_functions(); ++f)
+			if (should_analyze(graph->function(f)))
+				tabulation->add_entry(f);
+		tabulation->solve();
+
+		if (O_PROGRESS)
+			std::cout << "tabulation: " << tabulation->nr_summaries()
+				  << " summaries, " << tabulation->nr_path_edges()
+				  << " path edges, " << tabulation->degraded().size()
+				  << " degraded, " << tabulation->nr_widened()
+				  << " widened entries" << std::endl;
+	}
+
+	// functions that ran out of budget, on stdout and in -degraded-list
+	void print_degraded() {
+		std::error_code EC;
+		std::unique_ptr<raw_fd_ostream> list;
+		if (!DEGRADED_LIST.empty()) {
+			list.reset(new raw_fd_ostream(DEGRADED_LIST, EC, sys::fs::F_None));
+			if (EC) {
+				errs() << "Cannot write degraded list " << DEGRADED_LIST << "\n";
+				list.reset();
+			}
+		}
+
+		for (const AtomicTabulation::Degraded &D : tabulation->degraded()) {
+			StringRef fn = getFunctionName(graph->function(D.func));
+			std::cout << "degraded: " << fn.str() << " ("
+				  << exhausted_name(D.reason) << ")" << std::endl;
+			if (list)
+				*list << fn << " " << exhausted_name(D.reason) << "\n";
+		}
+	}
+
+	void print_report(const AtomicTabulation::Report &R) {
+		CallInst *CI = graph->site(R.site);
+		StringRef caller = getFunctionName(graph->function(R.func));
+		StringRef callee = "<indirect>";
+		for (CallGraphCSR::FuncId t : graph->targets(R.site)) {
+			StringRef name = getFunctionName(graph->function(t));
+			if (sleeping_functions.count(name)) {
+				callee = name;
+				break;
+			}
+		}
+
+		std::cout << "sleep-in-atomic: " << caller.str() << " -> "
+			  << callee.str() << " [" << atomic::to_string(R.fact)
+			  << "]";
+		if (const DebugLoc &Loc = CI->getDebugLoc())
+			std::cout << " at line " << Loc.getLine();
+		// found flow-insensitively, may be spurious
+		if (tabulation->is_degraded(R.func))
+			std::cout << " (degraded)";
+		std::cout << std::endl;
+
+		// the chain is only rebuilt for facts that became reports
+		std::vector<AtomicTabulation::Step> chain;
+		if (!tabulation->witness(R, chain))
+			return;
+		for (const AtomicTabulation::Step &S : chain) {
+			std::cout << "    " << getFunctionName(graph->function(S.func)).str()
+				  << " [" << atomic::to_string(S.entry) << " -> "
+				  << atomic::to_string(S.fact) << "] "
+				  << S.blocks.size() << " blocks";
+			if (const DebugLoc &Loc = graph->site(S.site)->getDebugLoc())
+				std::cout << ", call at line " << Loc.getLine();
+			std::cout << std::endl;
+		}
+	}
+
+	bool should_analyze(Function *F) {
+		if (single_fn_mode && getFunctionName(F) != SINGLE_FN)
+			return false;
+		if (blacklisted.count(F))
+			return false;
+		if (trivial.contains(F))
+			return false;
+		if (!sensilist.empty() && !sensitive.count(F))
+			return false;
+		if (slice && !slice->contains(F))
+			return false;
+		return true;
+	}
+
 public:
 	static char ID;
 
 	RSC() : CallGraphSCCPass(ID),
 		progress_os(progress_buf),
 		single_fn_mode(false),
+		graph(NULL),
 		ipp_id(0)
 		{}
 
@@ -128,42 +329,123 @@ public:
 
 		progress = 0;
 		total = M.size();
+		single_fn_mode = !SINGLE_FN.empty();
 
 		//cache_init();
 
-		/*std::string line;
-		std::ifstream fin(BLACKLIST);
-		if (fin.is_open()) {
-			while (std::getline(fin, line))
-				blacklist.push_back(line);
-			fin.close();
+		if (!BLACKLIST.empty() && !readFunctionList(BLACKLIST, blacklist))
+			errs() << "Cannot open blacklist " << BLACKLIST << "\n";
+		if (!SENSILIST.empty() && !readFunctionList(SENSILIST, sensilist))
+			errs() << "Cannot open sensilist " << SENSILIST << "\n";
+		if (!INLINELIST.empty() && !readFunctionList(INLINELIST, inlinelist))
+			errs() << "Cannot open inline list " << INLINELIST << "\n";
+
+		// resolve the names once, lookups below are by Function*
+		for (Function &F : M) {
+			StringRef fn = getFunctionName(&F);
+			if (blacklist.count(fn))
+				blacklisted.insert(&F);
+			if (sensilist.count(fn))
+				sensitive.insert(&F);
+		}
+
+		addDefaultAtomicEntries(enter_atomic_context_functions);
+		addDefaultSleepingPrimitives(sleeping_functions);
+
+		if (!MEMLOG.empty() && !memlog.open(MEMLOG))
+			errs() << "Cannot open memory log " << MEMLOG << "\n";
+		if (!TRACE.empty() && !trace::start(TRACE))
+			errs() << "Cannot open trace " << TRACE << "\n";
+
+		{
+			trace::Span S("callgraph");
+			ctx.reset(new GlobalContext());
+			ctx->MemLog = &memlog;
+			ModuleList modules(1, std::make_pair(&M,
+					StringRef(M.getModuleIdentifier())));
+			CallGraphPass CGP(ctx.get());
+			CGP.run(modules);
+			graph = &ctx->CallGraph;
+		}
+		log_memory("callgraph");
+
+		// constant "no effect" summaries, before any engine runs
+		{
+			trace::Span S("trivial_leaves");
+			trivial.compute(*graph, inlinelist, sleeping_functions);
+		}
+		if (O_PROGRESS)
+			std::cout << "trivial leaves: " << trivial.size() << std::endl;
+		log_memory("trivial_leaves");
+
+		if (SLICE) {
+			trace::Span S("slice");
+			slice.reset(new SensitiveSlice(enter_atomic_context_functions,
+						       sleeping_functions));
+			slice->compute(*graph);
+			if (O_PROGRESS)
+				std::cout << "slice: " << slice->size() << " of "
+					  << total << " functions" << std::endl;
+			log_memory("slice");
 		}
 
-		fin.open(SENSILIST);
-		if (fin.is_open()) {
-			while (std::getline(fin, line))
-				sensilist.push_back(line);
-			fin.close();
-		}*/
+		// the effect skeletons, extracted once for all later stages
+		{
+			trace::Span S("skeletons");
+			skeletons.reset(new Skeletons(*graph, sleeping_functions,
+						      &trivial));
+			for (CallGraphCSR::FuncId f = 0; f < graph->nr_functions(); ++f)
+				if (skeletons->has_body(f) &&
+				    should_analyze(graph->function(f)))
+					skeletons->of(f);
+		}
+		log_memory("skeletons");
 
-		enter_atomic_context_functions.push_back("local_irq_save");
+		if (TABULATE) {
+			tabulate();
+			log_memory("tabulation");
+		}
 
 		return false;
 	}
 
 	virtual bool runOnSCC(CallGraphSCC &SCC) {
+		Function *first = NULL;
+		uint64_t begin = trace::enabled ? trace::now() : 0;
 		for (auto node : SCC) {
 			Function *F = node->getFunction();
 			if (!F)
 				continue;
-			run_on_function(node, *F);
+			if (!should_analyze(F))
+				continue;
+			{
+				trace::Span S(getFunctionName(F), trace::FUNCTION);
+				run_on_function(node, *F);
+			}
+			if (!first)
+				first = F;
 		}
 
+		// named after its first analyzed function
+		if (trace::enabled && first)
+			trace::record(getFunctionName(first), trace::SCC, begin,
+				      trace::now());
+		if (MEMLOG_SCC && first)
+			log_memory("scc", getFunctionName(first));
+
 		return false;
 	}
 
 	virtual bool doFinalization(CallGraph &CG) {
 		//cache_finalize();
+		if (tabulation) {
+			trace::Span S("reports");
+			for (const AtomicTabulation::Report &R : tabulation->reports())
+				print_report(R);
+			print_degraded();
+		}
+		log_memory("final");
+		trace::finish();
 		return false;
 	}
 
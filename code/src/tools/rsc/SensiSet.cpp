@@ -0,0 +1,68 @@
+#include <iostream>
+#include <string>
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "util.h"
+#include "Slice.h"
+#include "rsc_CallGraph.h"
+
+using namespace llvm;
+using namespace rsc;
+
+static cl::opt<std::string>
+O_SENSISET("o-sensiset",
+	   cl::init("sensi-list"),
+	   cl::desc("Write the sensitive function set to the given file"));
+
+/*
+ * Compute the set of functions RSC needs to look at in one go. This replaces
+ * the per-SCC sensiset1/sensiset2 phases: both the forward propagation from
+ * atomic entries and the backward propagation from sleeping primitives run
+ * over the condensed call graph of the whole linked module, with indirect
+ * calls resolved by CallGraphPass as in the rsc pass.
+ */
+class SensiSet : public ModulePass {
+	StringSet<> entries;
+	StringSet<> sleepers;
+
+public:
+	static char ID;
+
+	SensiSet() : ModulePass(ID) {}
+
+	virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+		AU.setPreservesAll();
+	}
+
+	virtual bool runOnModule(Module &M) {
+		addDefaultAtomicEntries(entries);
+		addDefaultSleepingPrimitives(sleepers);
+
+		GlobalContext ctx;
+		ModuleList modules(1, std::make_pair(&M,
+				StringRef(M.getModuleIdentifier())));
+		CallGraphPass CGP(&ctx);
+		CGP.run(modules);
+
+		SensitiveSlice slice(entries, sleepers);
+		slice.compute(ctx.CallGraph);
+
+		if (!slice.write(O_SENSISET))
+			errs() << "Cannot write " << O_SENSISET << "\n";
+		std::cout << "sensiset: " << slice.size() << " of "
+			  << M.size() << " functions" << std::endl;
+		return false;
+	}
+
+	virtual void print(raw_ostream &O, const Module *M) const {}
+};
+
+char SensiSet::ID = 0;
+
+static RegisterPass<SensiSet> X("sensiset", "Compute the sensitive function set",
+				false /* Only looks at CFG */,
+				false /* Analysis Pass */);